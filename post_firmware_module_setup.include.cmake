@@ -17,3 +17,46 @@
    
 # message("Module source dir: ${KALEIDOSCOPE_MODULE_SOURCE_DIR}"))
 add_dependencies("kaleidoscope.firmware" kaleidoscope_papageno_glockenspiel_compile)
+
+if(KALEIDOSCOPE_PAPAGENO_PLAIN_TABLES)
+   add_dependencies("kaleidoscope.firmware" kaleidoscope_papageno_plain_tables)
+endif()
+
+# A cycle accurate benchmark of the firmware under simavr. Configure
+# the firmware build with 
+# KALEIDOSCOPE_FIRMWARE_SKETCH=<this module>/testing/benchmark/benchmark.ino
+#
+option(KALEIDOSCOPE_PAPAGENO_BENCHMARK 
+   "Add a target that runs the benchmark sketch under simavr" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_BENCHMARK)
+
+   if(KALEIDOSCOPE_HOST_BUILD)
+      message(FATAL_ERROR "KALEIDOSCOPE_PAPAGENO_BENCHMARK requires an atmega32u4 build")
+   endif()
+   
+   # The benchmark classifies events by the telemetry counters
+   #
+   if(NOT KALEIDOSCOPE_PAPAGENO_TELEMETRY)
+      message(FATAL_ERROR "KALEIDOSCOPE_PAPAGENO_BENCHMARK requires KALEIDOSCOPE_PAPAGENO_TELEMETRY")
+   endif()
+   
+   set(KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE "" CACHE FILEPATH 
+      "Benchmark results to compare against")
+   
+   # No baseline is shipped with the module. A baseline must be
+   # recorded from a run of the benchmark before it can gate a change.
+   #
+   if(KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE
+         AND NOT EXISTS "${KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE}")
+      message(FATAL_ERROR "KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE ${KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE} does not exist")
+   endif()
+   
+   add_custom_target(kaleidoscope_papageno_benchmark
+      COMMAND python3 
+         "${KALEIDOSCOPE_MODULE_SOURCE_DIR}/tools/papageno-benchmark.py"
+         "$<TARGET_FILE:kaleidoscope.firmware>"
+         ${KALEIDOSCOPE_PAPAGENO_BENCHMARK_BASELINE}
+      DEPENDS kaleidoscope.firmware
+   )
+endif()
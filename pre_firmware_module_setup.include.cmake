@@ -102,3 +102,81 @@ add_custom_target(kaleidoscope_papageno_glockenspiel_compile DEPENDS "${kaleidos
 add_dependencies(kaleidoscope_papageno_glockenspiel_compile kaleidoscope_papageno_build)
 
 list(APPEND modules_additional_headers "${kaleidoscope_papageno_source}")
+
+# Optional features of the plugin that are selected at compile time
+#
+option(KALEIDOSCOPE_PAPAGENO_STORAGE 
+   "Enable runtime rebinding of inputs and actions stored in EEPROM" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_STORAGE)
+   add_definitions(-DPPG_KLS_STORAGE_ENABLED)
+endif()
+
+option(KALEIDOSCOPE_PAPAGENO_TELEMETRY 
+   "Enable counters for pattern matching signals and input usage" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_TELEMETRY)
+   add_definitions(-DPPG_KLS_TELEMETRY_ENABLED)
+endif()
+
+set(KALEIDOSCOPE_PAPAGENO_LOG_LEVEL "0" CACHE STRING 
+   "Highest level of log records (0: disabled, 1: error, 2: warning, 3: info, 4: debug)")
+set(KALEIDOSCOPE_PAPAGENO_LOG_CATEGORIES "0xFF" CACHE STRING 
+   "Bitmask of enabled log categories (1: events, 2: signals, 4: actions, 8: loop)")
+   
+if(NOT "${KALEIDOSCOPE_PAPAGENO_LOG_LEVEL}" STREQUAL "0")
+   add_definitions(
+      -DPPG_KLS_LOG_LEVEL=${KALEIDOSCOPE_PAPAGENO_LOG_LEVEL}
+      -DPPG_KLS_LOG_CATEGORIES=${KALEIDOSCOPE_PAPAGENO_LOG_CATEGORIES}
+   )
+endif()
+
+option(KALEIDOSCOPE_PAPAGENO_VIRTUAL_CLOCK 
+   "Use a deterministic virtual clock instead of millis() (host builds only)" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_VIRTUAL_CLOCK)
+   if(NOT KALEIDOSCOPE_HOST_BUILD)
+      message(FATAL_ERROR "KALEIDOSCOPE_PAPAGENO_VIRTUAL_CLOCK requires a host build")
+   endif()
+   add_definitions(-DPPG_KLS_VIRTUAL_CLOCK)
+endif()
+
+option(KALEIDOSCOPE_PAPAGENO_DEFERRED_MATCHING 
+   "Queue key events during the matrix scan and match them in Papageno.loop()" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_DEFERRED_MATCHING)
+   add_definitions(-DPPG_KLS_DEFERRED_MATCHING)
+endif()
+
+set(KALEIDOSCOPE_PAPAGENO_MAX_BUFFERED_EVENTS "0" CACHE STRING 
+   "Flush buffered events before their number exceeds this limit (0: no limit)")
+   
+if(NOT "${KALEIDOSCOPE_PAPAGENO_MAX_BUFFERED_EVENTS}" STREQUAL "0")
+   add_definitions(
+      -DPPG_KLS_MAX_BUFFERED_EVENTS=${KALEIDOSCOPE_PAPAGENO_MAX_BUFFERED_EVENTS}
+   )
+endif()
+
+option(KALEIDOSCOPE_PAPAGENO_PLAIN_TABLES 
+   "Write the input tables as literal C++ instead of expanding X-macros" FALSE)
+   
+if(KALEIDOSCOPE_PAPAGENO_PLAIN_TABLES)
+
+   set(kaleidoscope_papageno_tables "${sketch_path}/Kaleidoscope-Papageno-Tables.hpp")
+   
+   add_custom_command(
+      OUTPUT "${kaleidoscope_papageno_tables}"
+      DEPENDS "${kaleidoscope_papageno_source}"
+      COMMAND python3 
+         "${KALEIDOSCOPE_MODULE_SOURCE_DIR}/tools/papageno-plain-tables.py"
+         "${kaleidoscope_papageno_source}"
+         "${kaleidoscope_papageno_tables}"
+   )
+   
+   add_custom_target(kaleidoscope_papageno_plain_tables DEPENDS "${kaleidoscope_papageno_tables}")
+   add_dependencies(kaleidoscope_papageno_plain_tables kaleidoscope_papageno_glockenspiel_compile)
+   
+   list(APPEND modules_additional_headers "${kaleidoscope_papageno_tables}")
+   
+   add_definitions(-DPPG_KLS_PLAIN_TABLES)
+endif()
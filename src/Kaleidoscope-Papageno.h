@@ -24,3 +24,6 @@ extern "C" {
 
 
 #include <Kaleidoscope/KPapageno.hpp>
+#include <Kaleidoscope/Papageno-Storage.h>
+#include <Kaleidoscope/Papageno-Telemetry.h>
+#include <Kaleidoscope/Papageno-Sequences.h>
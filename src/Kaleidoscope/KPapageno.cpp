@@ -22,6 +22,10 @@
 //
 #define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
 #include <Kaleidoscope-Papageno.h>
+#include <Kaleidoscope/Papageno-Storage.h>
+#include <Kaleidoscope/Papageno-Telemetry.h>
+#include <Kaleidoscope/Papageno-Queue.h>
+#include <Kaleidoscope/Papageno-Sequences.h>
 #include <kaleidoscope/hid.h>
 
 extern "C" {
@@ -30,21 +34,7 @@ extern "C" {
 #include "detail/ppg_context_detail.h"
 }
 
-// #define PPG_KLS_LOGGING_ENABLED
-
-#ifdef PPG_KLS_LOGGING_ENABLED 
-
-#include <iostream>
-
-#define PPG_KLS_LOG(TOKEN) \
-      std::cout << TOKEN;
-#define PPG_KLS_LOGN(TOKEN) \
-      std::cout << TOKEN << std::endl;
-   
-#else
-#define PPG_KLS_LOG(TOKEN)
-#define PPG_KLS_LOGN(TOKEN)
-#endif
+#include <Kaleidoscope/Papageno-Log.h>
 
 extern "C" {
    
@@ -55,6 +45,16 @@ extern "C" {
    __attribute__((weak)) 
    void papageno_initialize_context(void) {}
    
+#ifdef PPG_KLS_VIRTUAL_CLOCK
+   // Allows host test harnesses to advance the virtual clock 
+   // by means of a plain C symbol.
+   //
+   void papageno_advance_time(uint16_t delta)
+   {
+      kaleidoscope::papageno::clock::advance(delta);
+   }
+#endif
+   
 //    void serial_print(const char *c) {
 //       Serial.print(c);
 //    }
@@ -65,9 +65,15 @@ kaleidoscope::papageno::Papageno Papageno;
 namespace kaleidoscope {
 namespace papageno {
    
-extern void blockInput(uint8_t inputId);
-extern void unblockInput(uint8_t inputId);
-extern bool isInputBlocked(uint8_t inputId);
+#ifdef PPG_KLS_VIRTUAL_CLOCK
+namespace clock {
+uint16_t now_ = 0;
+}
+#endif
+   
+extern void blockInput(PPG_Input_Id inputId);
+extern void unblockInput(PPG_Input_Id inputId);
+extern bool isInputBlocked(PPG_Input_Id inputId);
 
 // constexpr uint8_t loopEventId = 255;
    
@@ -75,9 +81,117 @@ static uint8_t eventsFlushed_ = 0;
 
 static bool eventHandlerDisabled = false;
 static bool failureOccurred = false;
+#ifndef PPG_KLS_DEFERRED_MATCHING
 static bool justAddedLoopEvent = false;
+#endif
 static bool enabled = true;
 
+// Pattern profiles. Every profile is a Papageno context with
+// its own search tree. Profile zero is the context that is set up by
+// the Glockenspiel generated code. A profile without context 
+// contains no patterns at all.
+//
+static void *profileContexts[PPG_KLS_MAX_PROFILES] = { NULL };
+static uint8_t nProfiles = 0;
+static uint8_t activeProfile = 0;
+static uint8_t pendingProfile = 0;
+
+#ifdef PPG_KLS_DEFERRED_MATCHING
+
+#ifndef PPG_KLS_INGESTION_QUEUE_SIZE
+#define PPG_KLS_INGESTION_QUEUE_SIZE 8
+#endif
+
+// In deferred matching mode, the event handler hook only records
+// key events in the ingestion queue. The queue is drained and 
+// the events are passed to the pattern matching engine from loop().
+//
+// Presses of non-input keys are queued with input 
+// PPG_KLS_Not_An_Input to preserve their order relative to
+// the input events.
+//
+typedef struct {
+   PPG_Input_Id input;
+   PPG_Count flags;
+   PPG_Time time;
+   byte row;
+   byte col;
+} PPG_KLS_Ingested_Event;
+
+static PPG_KLS_Ring<PPG_KLS_Ingested_Event, PPG_KLS_INGESTION_QUEUE_SIZE> 
+   ingestionQueue;
+   
+static void drainIngestionQueue();
+
+// Queues an event for deferred matching. If the queue is full, 
+// it is drained right away rather than dropping the event.
+//
+static void ingestEvent(const PPG_KLS_Ingested_Event &event)
+{
+   if(!ingestionQueue.push(event)) {
+      PPG_KLS_COUNT(Ingestion_Queue_Full);
+      drainIngestionQueue();
+      ingestionQueue.push(event);
+   }
+   
+   PPG_KLS_HIGH_WATER(Ingestion_Queue, ingestionQueue.size());
+}
+
+#endif
+
+// The number of events that the pattern matching engine buffers
+// can optionally be limited. If the limit is reached, pattern matching
+// is aborted, i.e. the buffered events are flushed to Kaleidoscope,
+// before the next event is processed. This keeps a long typing burst 
+// from overrunning the engine's event buffer.
+//
+static void processEvent(PPG_Event *p_event)
+{
+#ifdef PPG_KLS_MAX_BUFFERED_EVENTS
+   if(ppg_event_buffer_size() >= PPG_KLS_MAX_BUFFERED_EVENTS) {
+      PPG_KLS_COUNT(Event_Limit);
+      ppg_global_abort_pattern_matching();
+   }
+#endif
+
+   // An event that completes or aborts a match empties the buffer
+   // and the token list. The levels are therefore sampled both 
+   // before and after processing.
+   //
+   PPG_KLS_HIGH_WATER(Active_Tokens, ppg_active_tokens_get_size());
+   PPG_KLS_HIGH_WATER(Buffered_Events, ppg_event_buffer_size());
+
+   ppg_event_process(p_event);
+   
+   PPG_KLS_HIGH_WATER(Active_Tokens, ppg_active_tokens_get_size());
+   PPG_KLS_HIGH_WATER(Buffered_Events, ppg_event_buffer_size());
+}
+
+inline
+static bool ingestionQueueEmpty()
+{
+#ifdef PPG_KLS_DEFERRED_MATCHING
+   return ingestionQueue.empty();
+#else
+   return true;
+#endif
+}
+
+#ifndef PPG_KLS_MACRO_QUEUE_SIZE
+#define PPG_KLS_MACRO_QUEUE_SIZE 4
+#endif
+
+// Macros that were triggered but are not yet played back completely.
+// Every entry points to a Key_NoKey terminated sequence in PROGMEM.
+//
+static PPG_KLS_Ring<const Key *, PPG_KLS_MACRO_QUEUE_SIZE> macroQueue;
+static const Key *currentMacroKey = NULL;
+static bool currentMacroKeyPressed = false;
+
+static const uint8_t *layerProfiles = NULL;
+static uint8_t nLayerProfiles = 0;
+static uint8_t lastLayer = 0xFF;
+
 struct TemporarilyDisableEventHandler
 {
    TemporarilyDisableEventHandler() { 
@@ -96,6 +210,21 @@ static uint8_t getKeystate(bool pressed)
    return ((pressed) ? (IS_PRESSED) : (WAS_PRESSED));
 }
 
+// Determines the key position of an input. Inputs may have been
+// rebound at runtime.
+//
+inline
+static PPG_KLS_Keypos keyposFromInputId(PPG_Input_Id input)
+{
+   PPG_KLS_Keypos keypos = ppg_kls_keypos_lookup[input];
+   
+#ifdef PPG_KLS_STORAGE_ENABLED
+   storage::inputKeypos(input, &keypos.row, &keypos.col);
+#endif
+
+   return keypos;
+}
+
 static void processEventCallback(   
                               PPG_Event *event,
                               void *)
@@ -124,6 +253,9 @@ static void processEventCallback(
    // Ignore events that were considered, i.e. swallowed by Papageno
    //
    if(event->flags & PPG_Event_Considered) {
+      if(event->flags & PPG_Event_Active) {
+         PPG_KLS_COUNT_INPUT(event->input, true);
+      }
       return;
    }
    
@@ -138,6 +270,9 @@ static void processEventCallback(
       //
       unblockInput(event->input);
    }
+   else {
+      PPG_KLS_COUNT_INPUT(event->input, false);
+   }
       
    // Note: Input-IDs are assigned contiguously
    //
@@ -145,24 +280,36 @@ static void processEventCallback(
    
    TemporarilyDisableEventHandler tdh;
    
-   PPG_KLS_LOG("event ")
-   PPG_KLS_LOG((uint16_t)event)
-   PPG_KLS_LOG(", input ")
-   PPG_KLS_LOG((int)event->input)
-   PPG_KLS_LOG(", group ")
-   PPG_KLS_LOGN((int)event->groupId)
-   
-   PPG_KLS_LOG("flushing event by keypos (")
-   PPG_KLS_LOG((int)ppg_kls_keypos_lookup[event->input].row)
-   PPG_KLS_LOG(", ")
-   PPG_KLS_LOG((int)ppg_kls_keypos_lookup[event->input].col)
-   PPG_KLS_LOG("), keystate = ")
-   PPG_KLS_LOG((int)keyState)
-   PPG_KLS_LOGN("")
-   
-   handleKeyswitchEvent(Key_NoKey, 
-                        ppg_kls_keypos_lookup[event->input].row,
-                        ppg_kls_keypos_lookup[event->input].col,
+   PPG_KLS_Keypos keypos;
+   Key key = Key_NoKey;
+   
+   // Keycode inputs are replayed with their keycode, as the key
+   // might be mapped differently on the layer that is now active.
+   //
+   if((int16_t)event->input > highestKeyposInputId()) {
+      
+      key = keyFromKeycodeInput(event->input);
+      
+      if(!keycodeInputKeypos(event->input, 
+                             event->flags & PPG_Event_Active,
+                             &keypos)) {
+         keypos.row = 0xFF;
+         keypos.col = 0xFF;
+#ifdef PPG_KLS_STORAGE_ENABLED
+         storage::inputKeypos(event->input, &keypos.row, &keypos.col);
+#endif
+      }
+   }
+   else {
+      keypos = keyposFromInputId(event->input);
+   }
+   
+   PPG_KLS_LOG_EVENT(DEBUG, EVENTS, Flush, 
+                     keyState, event->input, keypos.row << 8 | keypos.col);
+   
+   handleKeyswitchEvent(key, 
+                        keypos.row,
+                        keypos.col,
                         keyState);
    
 //       Kaleidoscope.preClearLoopHooks();
@@ -170,6 +317,8 @@ static void processEventCallback(
 //       Kaleidoscope.postClearLoopHooks();
    
    ++papageno::eventsFlushed_;
+   
+   PPG_KLS_COUNT(Flushed_Events);
 }
 
 static void flushEvents()
@@ -184,7 +333,7 @@ static void flushEvents()
 
 void time(PPG_Time *time)
 {
-   *time = static_cast<uint16_t>(millis());
+   *time = clock::now();
 }
 
 void timeDifference(PPG_Time time1, PPG_Time time2, PPG_Time *delta)
@@ -210,31 +359,32 @@ int8_t timeComparison(
 
 static void signalCallback(PPG_Signal_Id signal_id, void *)
 {
+   PPG_KLS_LOG_EVENT(INFO, SIGNALS, Signal, signal_id, 0, 0);
+   
    switch(signal_id) {
       case PPG_On_Abort:
-         PPG_KLS_LOGN("Abort")
+         PPG_KLS_COUNT(Abort);
          failureOccurred = true;
          papageno::flushEvents();
          break;
       case PPG_On_Timeout:
-         PPG_KLS_LOGN("Timeout")
+         PPG_KLS_COUNT(Timeout);
          failureOccurred = true;
          papageno::flushEvents();
          break;
       case PPG_On_Match_Failed:
-         PPG_KLS_LOGN("Match failed")
+         PPG_KLS_COUNT(Match_Failed);
          failureOccurred = true;
          // Events are flushed automatically in case of failure
          break;      
       case PPG_On_Flush_Events:
-         PPG_KLS_LOGN("Flush events")
+         PPG_KLS_COUNT(Flush_Events);
          papageno::flushEvents();
          break;
       case PPG_On_Initialization:
-         PPG_KLS_LOGN("On initialization")
          break;
       case PPG_Before_Action:
-         PPG_KLS_LOGN("Before action")
+         PPG_KLS_COUNT(Action);
          break;
       default:
          return;
@@ -257,23 +407,21 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
    //
    if(key_state & INJECTED) { return keycode; }
    
-   if(!enabled) {
+   if(!enabled || !profileContexts[activeProfile]) {
       return keycode;
    }
    
-   PPG_KLS_LOG("eventHandlerHook")
-   PPG_KLS_LOG(", row ")
-   PPG_KLS_LOG((int)row)
-   PPG_KLS_LOG(", col ")
-   PPG_KLS_LOG((int)col)
-   PPG_KLS_LOG(", keycode ")
-   PPG_KLS_LOG((int)keycode.raw)
-   PPG_KLS_LOG(", key_state ")
-   PPG_KLS_LOG((int)key_state)
-   PPG_KLS_LOGN("")
+   PPG_KLS_LOG_EVENT(DEBUG, EVENTS, Key, 
+                     key_state, row << 8 | col, keycode.raw);
    
    TemporarilyDisableEventHandler tdh;
    
+   // Actions of sequences may emit key events themselves
+   //
+   if(sequences::processKeyEvent(keycode, row, col, key_state)) {
+      return Key_NoKey;
+   }
+   
    PPG_Count flags = PPG_Event_Flags_Empty;
    bool keyStateChanged = true;
    if (keyToggledOn(key_state)) {
@@ -283,7 +431,15 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
       keyStateChanged = false;
    }
          
-   uint8_t input = inputIdFromKeypos(row, col);
+   PPG_Input_Id input = inputIdFromKeypos(row, col);
+   
+#ifdef PPG_KLS_STORAGE_ENABLED
+   input = storage::resolveInput(row, col, input);
+#endif
+
+   if(input == PPG_KLS_Not_An_Input) {
+      input = inputIdFromKeycode(keycode, row, col, key_state);
+   }
    
    if(input == PPG_KLS_Not_An_Input) { 
       
@@ -293,6 +449,33 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
       if(flags != PPG_Event_Active) {
          return keycode;
       }
+      
+      PPG_KLS_COUNT(Passthrough);
+      
+#ifdef PPG_KLS_DEFERRED_MATCHING
+      // Non-input keys only have to wait if input events are
+      // queued before them or pattern matching is in progress.
+      //
+      if(   !ingestionQueue.empty() 
+         || ppg_pattern_matching_in_progress()) {
+         
+         // Events without a valid key position, e.g. keys injected
+         // at UNKNOWN_KEYSWITCH_LOCATION, could not be replayed
+         // from the queue. They are passed through unqueued.
+         //
+         if((row >= ROWS) || (col >= COLS)) {
+            return keycode;
+         }
+         
+         PPG_KLS_Ingested_Event event = { 
+            PPG_KLS_Not_An_Input, flags, clock::now(), row, col 
+         };
+         
+         ingestEvent(event);
+         
+         return Key_NoKey;
+      }
+#endif
          
 //          PPG_LOG("not an input\n");
       
@@ -300,9 +483,6 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
       //
 //       if(flags == PPG_Event_Active) {
 
-         PPG_KLS_LOGN("before: keycode " << keycode.raw
-            << ", layerState " << Layer.getLayerState())
-         
          papageno::eventsFlushed_ = 0;
          
          // Whenever a key occurs that is not an input,
@@ -325,10 +505,9 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
             keycode = Layer.lookupOnActiveLayer(row, col);
          }
          
-         PPG_KLS_LOGN("Events flushed: " << (int)papageno::eventsFlushed_)
-         
-         PPG_KLS_LOGN("after: keycode " << keycode.raw
-            << ", layerState " << Layer.getLayerState())
+         PPG_KLS_LOG_EVENT(INFO, EVENTS, Abort, 
+                           papageno::eventsFlushed_, 
+                           row << 8 | col, keycode.raw);
 //       }
       
       // Let Kaleidoscope process the key in a regular way
@@ -344,7 +523,7 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
       // flushed and we pass the keycode on
       //
       if(!isInputBlocked(input)) {
-         PPG_KLS_LOG("Passing keycode of unblocked input\n")
+         PPG_KLS_LOG_EVENT(DEBUG, EVENTS, Passthrough, 0, input, 0);
          return keycode;
       }
             
@@ -354,7 +533,7 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
       if(failureOccurred
          && !ppg_pattern_matching_in_progress()
       ) {
-         PPG_KLS_LOG("Bad engine state => passing keycode\n")
+         PPG_KLS_LOG_EVENT(WARNING, EVENTS, Bad_State, 0, input, 0);
          return keycode;
       }
       
@@ -373,14 +552,29 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
    //
    if(   (ppg_event_buffer_size() == 0) 
       && (ppg_active_tokens_get_size() == 0)
+      && ingestionQueueEmpty()
       && (flags == PPG_Event_Flags_Empty)) 
    {
       return keycode;
    }
       
+   if(flags == PPG_Event_Active) {
+      
+      // Mark the input as blocked
+      //
+      blockInput(input);
+   }
+   
+#ifdef PPG_KLS_DEFERRED_MATCHING
+   PPG_KLS_Ingested_Event event = { 
+      input, flags, (PPG_Time)clock::now(), row, col 
+   };
+   
+   ingestEvent(event);
+#else
    PPG_Event p_event = {
       .input = input,
-      .time = (PPG_Time)millis(),
+      .time = (PPG_Time)clock::now(),
       .flags = flags,
       
       // The group id is used to code the loop count a event occured
@@ -393,21 +587,64 @@ static Key eventHandlerHook(Key keycode, byte row, byte col, uint8_t key_state)
    
    ppg_global_set_layer(cur_layer);
    
-   PPG_KLS_LOGN("Feeding event")
-   
-   if(flags == PPG_Event_Active) {
-      
-      // Mark the input as blocked
-      //
-      blockInput(input);
-   }
+   PPG_KLS_LOG_EVENT(DEBUG, EVENTS, Feed, flags, input, p_event.time);
 
    justAddedLoopEvent = false;
-   ppg_event_process(&p_event);
+   processEvent(&p_event);
+#endif
    
    return Key_NoKey;
 }
 
+#ifdef PPG_KLS_DEFERRED_MATCHING
+
+// Passes all queued events to the pattern matching engine. 
+//
+static void drainIngestionQueue()
+{
+   TemporarilyDisableEventHandler tdh;
+   
+   PPG_KLS_Ingested_Event event;
+   
+   while(ingestionQueue.pop(event)) {
+      
+      if(event.input == PPG_KLS_Not_An_Input) {
+         
+         // A non-input key was pressed while pattern matching was
+         // in progress. 
+         //
+         ppg_global_abort_pattern_matching();
+         
+         // The layer might have been changed by aborting 
+         // pattern matching
+         //
+         Layer.updateLiveCompositeKeymap(event.row, event.col);
+         
+         handleKeyswitchEvent(Key_NoKey, event.row, event.col, IS_PRESSED);
+         
+         continue;
+      }
+      
+      failureOccurred = false;
+      
+      PPG_Event p_event = {
+         .input = event.input,
+         .time = event.time,
+         .flags = event.flags,
+         .groupId = 0
+      };
+   
+      ppg_global_set_layer(Layer.top());
+   
+      PPG_KLS_LOG_EVENT(DEBUG, EVENTS, Feed, 
+                        event.flags, event.input, event.time);
+      
+      processEvent(&p_event);
+   }
+}
+
+#endif
+
 void 
    Papageno
       ::begin() 
@@ -418,17 +655,21 @@ void
 //    
    this->init();
    
+   profileContexts[0] = ppg_global_get_current_context();
+   nProfiles = 1;
+   
+#ifdef PPG_KLS_STORAGE_ENABLED
+   storage::begin();
+#endif
+   
    Kaleidoscope.useEventHandlerHook(
          kaleidoscope::papageno::eventHandlerHook);
 }
 
-void 
-   Papageno
-      ::init()
+// Registers the plugin's callbacks with the current Papageno context
+//
+static void registerCallbacks()
 {
-   Kaleidoscope.setKeyboardReportSendPolicy(
-         kaleidoscope::KeyboardReportSendOnEvent);
-   
    ppg_global_set_default_event_processor(
       (PPG_Event_Processor_Fun)kaleidoscope::papageno::processEventCallback);
 
@@ -450,17 +691,124 @@ void
       }
    );
    
+}
+
+void 
+   Papageno
+      ::init()
+{
+   Kaleidoscope.setKeyboardReportSendPolicy(
+         kaleidoscope::KeyboardReportSendOnEvent);
+   
+   registerCallbacks();
+   
 //    ppg_timeout_set_state(false); // Generally disable timeout to
 //                                  // prevent asynchronous timout handling
 }
 
-void  
+uint8_t 
    Papageno
-      ::processKeycode(PPG_Count activation_flags, void *user_data)
-{   
-   Key key;
-   key.raw = (uint16_t)((uintptr_t)user_data);
+      ::addProfile(void *context)
+{
+   if(nProfiles == PPG_KLS_MAX_PROFILES) {
+      return PPG_KLS_Not_A_Profile;
+   }
+   
+   if(context) {
+      void *current = ppg_global_set_current_context(context);
+      registerCallbacks();
+      ppg_global_set_current_context(current);
+   }
+   
+   profileContexts[nProfiles] = context;
+   
+   return nProfiles++;
+}
+
+void 
+   Papageno
+      ::setProfile(uint8_t profile)
+{
+   if(profile < nProfiles) {
+      pendingProfile = profile;
+   }
+}
+
+uint8_t 
+   Papageno
+      ::getProfile()
+{
+   return activeProfile;
+}
+
+void 
+   Papageno
+      ::switchProfile(PPG_Count activation_flags, void *user_data)
+{
+   PPG_CALLBACK_NO_REPEAT
+   PPG_CALLBACK_ONLY_ACTIVATION
+   
+   setProfile((uint8_t)((uintptr_t)user_data));
+}
+
+void 
+   Papageno
+      ::setLayerProfiles(const uint8_t *profiles, uint8_t n_profiles)
+{
+   layerProfiles = profiles;
+   nLayerProfiles = n_profiles;
+   lastLayer = 0xFF;
+}
+
+// Profile changes are requested from action callbacks or 
+// user code but only applied between scan cycles. Thus,
+// a profile never changes while its tree is being matched.
+//
+static void updateProfile()
+{
+   if(layerProfiles) {
+      
+      uint8_t layer = Layer.top();
       
+      if((layer != lastLayer) && (layer < nLayerProfiles)) {
+         pendingProfile = pgm_read_byte(layerProfiles + layer);
+      }
+      
+      lastLayer = layer;
+   }
+   
+   if(   (pendingProfile == activeProfile)
+      || (pendingProfile >= nProfiles)) {
+      return;
+   }
+   
+#ifdef PPG_KLS_DEFERRED_MATCHING
+   // Queued events belong to the current profile
+   //
+   if(profileContexts[activeProfile]) {
+      drainIngestionQueue();
+   }
+#endif
+   
+   TemporarilyDisableEventHandler tdh;
+   
+   // Any events that are pending for the current profile
+   // are passed on to Kaleidoscope.
+   //
+   if(profileContexts[activeProfile]) {
+      ppg_global_abort_pattern_matching();
+   }
+   
+   if(profileContexts[pendingProfile]) {
+      ppg_global_set_current_context(profileContexts[pendingProfile]);
+   }
+   
+   activeProfile = pendingProfile;
+}
+
+inline
+static uint8_t actionKeystate(PPG_Count activation_flags)
+{
    uint8_t keyState = kaleidoscope::papageno::getKeystate(
                   activation_flags & PPG_Action_Activation_Flags_Active);
    
@@ -469,11 +817,12 @@ void
       keyState |= WAS_PRESSED;
    }
    
-   PPG_KLS_LOG("keycode action. keycode ")
-   PPG_KLS_LOG((int)key.raw)
-   PPG_KLS_LOG(", keyState ")
-   PPG_KLS_LOG((int)keyState)
-   PPG_KLS_LOGN("")
+   return keyState;
+}
+
+static void emitKeycode(Key key, uint8_t keyState)
+{
+   PPG_KLS_LOG_EVENT(INFO, ACTIONS, Keycode_Action, keyState, key.raw, 0);
    
    // Note: Setting UNKNOWN_KEYSWITCH_LOCATION will skip keymap lookup
    //
@@ -483,27 +832,12 @@ void
    }
 }
 
-void processKeypos(PPG_Count activation_flags, void *user_data)
+static void emitKeypos(uint16_t raw, uint8_t keyState)
 {
-   uint16_t raw = (uint16_t)((uintptr_t)user_data);
    uint8_t row = raw >> 8;
    uint8_t col = raw & 0x00FF;
-         
-   uint8_t keyState = kaleidoscope::papageno::getKeystate(
-                  activation_flags & PPG_Action_Activation_Flags_Active);
    
-   if(   (keyState & IS_PRESSED) 
-      && (activation_flags & PPG_Action_Activation_Flags_Repeated)) {
-      keyState |= WAS_PRESSED;
-   }
-   
-   PPG_KLS_LOG("keypos action. row ")
-   PPG_KLS_LOG((int)row)
-   PPG_KLS_LOG(", col ")
-   PPG_KLS_LOG((int)col)
-   PPG_KLS_LOG(", keyState ")
-   PPG_KLS_LOG((int)keyState)
-   PPG_KLS_LOGN("")
+   PPG_KLS_LOG_EVENT(INFO, ACTIONS, Keypos_Action, keyState, raw, 0);
 
    {
       TemporarilyDisableEventHandler tdh;
@@ -511,6 +845,114 @@ void processKeypos(PPG_Count activation_flags, void *user_data)
    }
 }
 
+// Emits an action that might have been rebound at runtime
+//
+static void emitAction(uint8_t kind, uint16_t raw, uint8_t keyState)
+{
+#ifdef PPG_KLS_STORAGE_ENABLED
+   uint16_t replacement;
+   uint8_t replacementKind = storage::resolveAction(kind, raw, &replacement);
+   
+   if(replacementKind != 0) {
+      kind = replacementKind;
+      raw = replacement;
+   }
+#endif
+   
+   if(kind == PPG_KLS_Binding_Keypos) {
+      emitKeypos(raw, keyState);
+   }
+   else {
+      Key key;
+      key.raw = raw;
+      emitKeycode(key, keyState);
+   }
+}
+
+void  
+   Papageno
+      ::processKeycode(PPG_Count activation_flags, void *user_data)
+{   
+   emitAction(PPG_KLS_Binding_Keycode, 
+              (uint16_t)((uintptr_t)user_data),
+              actionKeystate(activation_flags));
+}
+
+void 
+   Papageno
+      ::processKeypos(PPG_Count activation_flags, void *user_data)
+{
+   emitAction(PPG_KLS_Binding_Keypos, 
+              (uint16_t)((uintptr_t)user_data),
+              actionKeystate(activation_flags));
+}
+
+void 
+   Papageno
+      ::processMacro(PPG_Count activation_flags, void *user_data)
+{
+   PPG_CALLBACK_NO_REPEAT
+   PPG_CALLBACK_ONLY_ACTIVATION
+   
+   // If the queue is full, the macro is dropped. Playing it back
+   // right here would block the firmware for the whole sequence.
+   //
+   if(!macroQueue.push((const Key *)user_data)) {
+      PPG_KLS_COUNT(Macro_Queue_Full);
+      PPG_KLS_LOG_EVENT(WARNING, ACTIONS, Macro_Dropped, 
+                        macroQueue.size(), (uintptr_t)user_data, 0);
+   }
+   
+   PPG_KLS_HIGH_WATER(Macro_Queue, macroQueue.size());
+}
+
+void 
+   Papageno
+      ::leadSequences(PPG_Count activation_flags, void *user_data)
+{
+   PPG_CALLBACK_NO_REPEAT
+   PPG_CALLBACK_ONLY_ACTIVATION
+   
+   sequences::arm((const PPG_KLS_Sequence_Automaton *)user_data);
+}
+
+// Plays back a single key event of the pending macros. As the keyboard 
+// report is sent once per scan cycle, every press and every release
+// end up in a report of their own.
+//
+static void playMacros()
+{
+   if(!currentMacroKey) {
+      
+      if(!macroQueue.pop(currentMacroKey)) {
+         return;
+      }
+      
+      currentMacroKeyPressed = false;
+   }
+   
+   Key key;
+   key.raw = pgm_read_word(&currentMacroKey->raw);
+   
+   if(key.raw == Key_NoKey.raw) {
+      currentMacroKey = NULL;
+      return;
+   }
+   
+   TemporarilyDisableEventHandler tdh;
+   
+   if(!currentMacroKeyPressed) {
+      handleKeyswitchEvent(key, UNKNOWN_KEYSWITCH_LOCATION, IS_PRESSED);
+      currentMacroKeyPressed = true;
+      return;
+   }
+   
+   handleKeyswitchEvent(key, UNKNOWN_KEYSWITCH_LOCATION, WAS_PRESSED);
+   currentMacroKeyPressed = false;
+   
+   ++currentMacroKey;
+}
+
 // static bool conditionallyAddLoopEvent()
 // {   
 //    if(!ppg_pattern_matching_in_progress()) {
@@ -542,22 +984,34 @@ void
    Papageno
       ::loop()
 {
-   if(!enabled) {
-      Kaleidoscope.loop();
-      return;
-   }
+   clock::tick();
+   
+   updateProfile();
+   
+   bool matching = enabled && profileContexts[activeProfile];
    
 //    bool haveLoopHandlers = true;
    
-   PPG_KLS_LOGN("Kaleidoscope process key events")
-   Kaleidoscope.processKeyEvents();
-
+   if(matching) {
+      Kaleidoscope.processKeyEvents();
+   }
+   
+   // Events that were queued, sequences that were led and macros 
+   // that were triggered before the plugin was disabled are
+   // completed nonetheless. Switching to a profile without patterns
+   // drains the queue beforehand (see updateProfile).
+   //
+#ifdef PPG_KLS_DEFERRED_MATCHING
+   if(profileContexts[activeProfile]) {
+      drainIngestionQueue();
+   }
+#endif
    
    // As timeout might cause events e.g. when a tap-dance is 
    // activated, we have to make sure that we do not run into a loop
    // here.
    //
-   {
+   if(matching) {
       TemporarilyDisableEventHandler tdh;
 //       PPG_KLS_LOGN("Timeout check")
 //       ppg_timeout_set_state(true);
@@ -565,6 +1019,18 @@ void
 //       ppg_timeout_set_state(false);
    }
    
+   {
+      TemporarilyDisableEventHandler tdh;
+      sequences::checkTimeout();
+   }
+   
+   playMacros();
+   
+   if(!matching) {
+      Kaleidoscope.loop();
+      return;
+   }
+   
 //    if(ppg_pattern_matching_in_progress()) {
 //       if(conditionallyAddLoopEvent()) {
 //          PPG_KLS_LOGN("Conditionally added loop event")
@@ -574,7 +1040,6 @@ void
 //    }
    
 //    if(haveLoopHandlers) {
-      PPG_KLS_LOGN("Kaleidoscope loop hooks")
 //       Kaleidoscope.processLoopHooks();
       
       Kaleidoscope.preClearLoopHooks();
@@ -582,11 +1047,20 @@ void
       Kaleidoscope.postClearLoopHooks();
 //    }
       
-   //       PPG_KLS_LOG("active tokens")
-   PPG_KLS_LOGN("# active tokens: " << (int)PPG_GAT.n_tokens)
+   PPG_KLS_LOG_EVENT(DEBUG, LOOP, Loop, 
+                     0, PPG_GAT.n_tokens, ppg_event_buffer_size());
    ppg_active_tokens_repeat_actions();
 }
 
+#ifdef PPG_KLS_VIRTUAL_CLOCK
+void 
+   Papageno
+      ::advanceTime(uint16_t delta)
+{
+   clock::advance(delta);
+}
+#endif
+
 void 
    Papageno
       ::setEnabled(bool state)
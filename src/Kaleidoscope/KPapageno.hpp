@@ -19,6 +19,11 @@
 #pragma once
 
 #include <Kaleidoscope.h>
+#include <Kaleidoscope/Papageno-Clock.h>
+
+#ifndef PPG_KLS_MAX_PROFILES
+#define PPG_KLS_MAX_PROFILES 4
+#endif
 
 // avr-gcc compiles files with .c ending with C name mangling
 //
@@ -34,6 +39,26 @@ typedef struct {
    byte col;
 } PPG_KLS_Keypos;
 
+// Selects the narrowest unsigned type that holds values up to
+// a given maximum. (There is no <type_traits> on avr-gcc.)
+//
+template<bool Wide__>
+struct PPG_KLS_Uint_Select { typedef uint8_t Type; };
+
+template<>
+struct PPG_KLS_Uint_Select<true> { typedef uint16_t Type; };
+
+// Matrix positions are encoded as a single index row*COLS + col.
+// For matrices of up to 256 keys, the index fits in a byte.
+//
+typedef PPG_KLS_Uint_Select<(ROWS*COLS > 256)>::Type PPG_KLS_Keypos_Index;
+
+inline
+PPG_KLS_Keypos_Index keyposIndex(byte row, byte col)
+{
+   return (PPG_KLS_Keypos_Index)(row*COLS + col);
+}
+
 class Papageno : public KaleidoscopePlugin
 {
    public:
@@ -49,16 +74,79 @@ class Papageno : public KaleidoscopePlugin
       //
       static void processKeycode(PPG_Count activation_flags, void *user_data);
       static void processKeypos(PPG_Count activation_flags, void *user_data);
+      static void processMacro(PPG_Count activation_flags, void *user_data);
+      
+      // A user function action that arms the leader sequence automaton 
+      // (see Papageno-Sequences.h) that is passed as user data, e.g.
+      //
+      //    action: lead <USER_FUNCTION> = 
+      //       $ kaleidoscope::papageno::Papageno::leadSequences, 
+      //            (void*)&my_sequences $
+      //
+      static void leadSequences(PPG_Count activation_flags, void *user_data);
       
       void loop();
       
+      // Pattern profiles
+      //
+      // Every profile is a Papageno context with its own search tree.
+      // Profile 0 is the tree that is defined in the sketch. Additional 
+      // contexts are registered via addProfile. Passing a NULL context
+      // registers a profile without any patterns.
+      //
+      // Glockenspiel generates a single tree per sketch. Contexts of
+      // further profiles must currently be built by means of Papageno's
+      // C API (ppg_context_create, ppg_global_set_current_context 
+      // and Papageno's pattern functions) in the sketch's setup().
+      //
+      // Profile changes are applied at the beginning of the next
+      // call to loop(). Pattern matching that is in progress is aborted.
+      //
+      static uint8_t addProfile(void *context);
+      static void setProfile(uint8_t profile);
+      static uint8_t getProfile();
+      
+      // A user function action that switches to the profile 
+      // that is passed as user data, e.g.
+      //
+      //    action: gaming <USER_FUNCTION> = 
+      //       $ kaleidoscope::papageno::Papageno::switchProfile, (void*)1 $
+      //
+      static void switchProfile(PPG_Count activation_flags, void *user_data);
+      
+      // Associates profiles with layers. The PROGMEM array contains
+      // one profile id per layer. Whenever the top layer changes,
+      // the associated profile is activated.
+      //
+      static void setLayerProfiles(const uint8_t *profiles, uint8_t n_profiles);
+      
+#ifdef PPG_KLS_VIRTUAL_CLOCK
+      // Advances the virtual clock, e.g. to skip over a timeout
+      // in a host test.
+      //
+      static void advanceTime(uint16_t delta);
+#endif
+      
    private:
 
       static Key eventHandlerHook(Key mapped_key, byte row, byte col, uint8_t key_state);
 //       static void loopHook(bool is_post_clear);
 };
 
-enum { PPG_KLS_Not_An_Input = (PPG_Input_Id)-1 };
+// The width of input ids is that of Papageno's PPG_Input_Id.
+// The largest value is reserved to mark keys that are no inputs.
+//
+enum : PPG_Input_Id { PPG_KLS_Not_An_Input = (PPG_Input_Id)-1 };
+
+enum { PPG_KLS_Not_A_Profile = 0xFF };
+
+// The kinds of actions that emit keys. Actions of type KEYCODE and
+// COMPLEX_KEYCODE are both of kind PPG_KLS_Binding_Keycode.
+//
+enum { 
+   PPG_KLS_Binding_Keycode = 1,
+   PPG_KLS_Binding_Keypos = 2
+};
 
 // The following extern entities are initialized in Papageno-Initialization.h
 //
@@ -66,8 +154,18 @@ extern PPG_KLS_Keypos ppg_kls_keypos_lookup[];
 
 extern PPG_Input_Id inputIdFromKeypos(byte row, byte col);
 
+extern PPG_Input_Id inputIdFromKeycode(Key keycode, byte row, byte col, 
+                                       uint8_t key_state);
+
+extern bool keycodeInputKeypos(PPG_Input_Id input, bool pressed, 
+                               PPG_KLS_Keypos *keypos);
+
+extern Key keyFromKeycodeInput(PPG_Input_Id input);
+
 extern int16_t highestKeyposInputId();
 
+extern PPG_Input_Id numberOfInputs();
+
 extern void time(PPG_Time *time);
 
 extern void timeDifference(PPG_Time time1, PPG_Time time2, PPG_Time *delta);
@@ -87,11 +185,20 @@ extern kaleidoscope::papageno::Papageno Papageno;
 #define PPG_KLS_KEYPOS_INPUT(UNIQUE_ID)                                               \
    PPG_KLS_TRICAT(PPG_, UNIQUE_ID, _Keypos_Name)
    
+#define PPG_KLS_KEYCODE_INPUT(UNIQUE_ID)                                       \
+   PPG_KLS_TRICAT(PPG_, UNIQUE_ID, _Keycode_Name)
+   
 #define PPG_CALLBACK_NO_REPEAT \
    if(activation_flags & PPG_Action_Activation_Flags_Repeated) { return; }
    
 #define PPG_CALLBACK_ONLY_ACTIVATION \
    if(!(activation_flags & PPG_Action_Activation_Flags_Active)) { return; }
+   
+// Defines a key sequence in PROGMEM that can be used 
+// by MACRO actions. The sequence is terminated by Key_NoKey.
+//
+#define PPG_KLS_MACRO(NAME, ...)                                               \
+   static const Key NAME[] PROGMEM = { __VA_ARGS__, Key_NoKey };
 
 //##############################################################################
 // Definitions for Papageno's Glockenspiel compiler interface
@@ -106,6 +213,34 @@ extern kaleidoscope::papageno::Papageno Papageno;
 #define GLS_INPUT_INITIALIZE___KEYPOS(UNIQUE_ID, USER_ID, ROW, COL) \
    kaleidoscope::papageno::PPG_KLS_KEYPOS_INPUT(UNIQUE_ID)
    
+#define GLS_ENABLE_INPUTS_LOCAL_INITIALIZATION___KEYCODE
+#define GLS_ENABLE_INPUTS_LOCAL_INITIALIZATION___COMPLEX_KEYCODE
+
+// Keycode inputs are resolved from the keycode that a key
+// is mapped to on the active layers. The name of a KEYCODE input 
+// is the name of the key.
+//
+#define GLS_INPUT_INITIALIZE___KEYCODE(UNIQUE_ID, USER_ID)                     \
+   kaleidoscope::papageno::PPG_KLS_KEYCODE_INPUT(UNIQUE_ID)
+   
+#define GLS_INPUT_INITIALIZE___COMPLEX_KEYCODE(UNIQUE_ID, USER_ID, ...)        \
+   kaleidoscope::papageno::PPG_KLS_KEYCODE_INPUT(UNIQUE_ID)
+   
+// With telemetry, the callback of every action is wrapped to count
+// the matches of its pattern. The ids are assigned in the order in which 
+// the action initializers appear in the generated code, starting from zero.
+// User functions must then have the exact signature of 
+// PPG_Action_Callback_Fun as they become template arguments.
+//
+#ifdef PPG_KLS_TELEMETRY_ENABLED
+#define PPG_KLS_ACTION_CALLBACK(FUNC)                                          \
+   kaleidoscope::papageno::telemetry::countedAction<                           \
+      __COUNTER__ - kaleidoscope::papageno::telemetry::PPG_KLS_Action_Id_Base  \
+         - 1, FUNC>
+#else
+#define PPG_KLS_ACTION_CALLBACK(FUNC) FUNC
+#endif
+
 // Keycode actions are compile time constant and can thus already be
 // assigned when the global static Papageno search tree is initialized.
 //
@@ -113,7 +248,7 @@ extern kaleidoscope::papageno::Papageno Papageno;
 __NL__   {                                                                     \
 __NL__      __GLS_DI__(callback)  {                                                \
 __NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)                          \
-__NL__                    kaleidoscope::papageno::Papageno::processKeycode,    \
+__NL__                    PPG_KLS_ACTION_CALLBACK(kaleidoscope::papageno::Papageno::processKeycode), \
 __NL__         __GLS_DI__(user_data) reinterpret_cast<void*>((__VA_ARGS__).raw)    \
 __NL__      }                                                                  \
 __NL__   } 
@@ -122,7 +257,7 @@ __NL__   }
 __NL__   {                                                                     \
 __NL__      __GLS_DI__(callback)  {                                                \
 __NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)                          \
-__NL__                    kaleidoscope::papageno::Papageno::processKeycode,    \
+__NL__                    PPG_KLS_ACTION_CALLBACK(kaleidoscope::papageno::Papageno::processKeycode), \
 __NL__         __GLS_DI__(user_data) reinterpret_cast<void*>((__VA_ARGS__).raw)    \
 __NL__      }                                                                  \
 __NL__   } 
@@ -131,7 +266,7 @@ __NL__   }
 __NL__   {                                                                     \
 __NL__      __GLS_DI__(callback)  {                                                \
 __NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)                          \
-__NL__                    kaleidoscope::papageno::Papageno::processKeypos,     \
+__NL__                    PPG_KLS_ACTION_CALLBACK(kaleidoscope::papageno::Papageno::processKeypos), \
 __NL__         __GLS_DI__(user_data) (void*)(uint16_t((ROW) << 8 | (COL)))         \
 __NL__      }                                                                  \
 __NL__   } 
@@ -139,11 +274,24 @@ __NL__   }
 #define GLS_ACTION_INITIALIZE___USER_FUNCTION(UNIQUE_ID, USER_ID, FUNC, USER_DATA)             \
 __NL__   {                                                                     \
 __NL__      __GLS_DI__(callback)  {                                                \
-__NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)FUNC,                     \
+__NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)PPG_KLS_ACTION_CALLBACK(FUNC), \
 __NL__         __GLS_DI__(user_data) USER_DATA                                     \
 __NL__      }                                                                  \
 __NL__   } 
 
+// Macro actions are played back by Papageno::loop(), one key event 
+// per scan cycle. The argument is the name of a key sequence that
+// has been defined via PPG_KLS_MACRO.
+//
+#define GLS_ACTION_INITIALIZE___MACRO(UNIQUE_ID, USER_ID, SEQUENCE)            \
+__NL__   {                                                                     \
+__NL__      __GLS_DI__(callback)  {                                                \
+__NL__         __GLS_DI__(func) (PPG_Action_Callback_Fun)                          \
+__NL__                    PPG_KLS_ACTION_CALLBACK(kaleidoscope::papageno::Papageno::processMacro), \
+__NL__         __GLS_DI__(user_data) (void*)(SEQUENCE)                             \
+__NL__      }                                                                  \
+__NL__   } 
+
 // A file that is included in the Glockenspiel-generated
 // representation of the Papageno tree just before any C/C++
 // stuff is defined. 
@@ -152,10 +300,14 @@ __NL__   }
 //
 #define GLS_GLOBAL_INITIALIZATION_INCLUDE "Kaleidoscope/Papageno-Initialization.h"
 
-// Use an artificial event queue size to make sure that there is enough
-// space for synthesized loop events.
+// Glockenspiel sizes the event queue from the pattern tree. A sketch
+// may scale that size by defining PPG_KLS_EVENT_QUEUE_SIZE(S), e.g.
+// as (2*(S)) to leave space for synthesized loop events. The telemetry's
+// high-water marks show how much of the queue is actually used.
 //
-// #define GLS_EVENT_QUEUE_SIZE(S) (2*(S))
+#ifdef PPG_KLS_EVENT_QUEUE_SIZE
+#define GLS_EVENT_QUEUE_SIZE(S) PPG_KLS_EVENT_QUEUE_SIZE(S)
+#endif
 
 /*
 glockenspiel_begin
@@ -206,6 +358,11 @@ action: my_keypos_action <KEYPOS> = $1, 3$
 %
 action: my_func <USER_FUNCTION> = $the_function_name, nullptr$
 
+% A macro action that plays a key sequence that is defined in the sketch
+% via PPG_KLS_MACRO(my_sequence, Key_A, Key_B).
+%
+action: my_macro <MACRO> = $my_sequence$
+
 glockenspiel_end
 */
 
@@ -0,0 +1,83 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// The time source of the plugin
+//
+// By default, time is read from Arduino's millis(). If the plugin
+// is compiled with PPG_KLS_VIRTUAL_CLOCK defined, a virtual clock is
+// used instead that only advances by PPG_KLS_VIRTUAL_CLOCK_TICK
+// milliseconds per call to Papageno::loop() and whenever it is advanced
+// explicitly. This renders timing in host builds deterministic and
+// allows tests to skip over timeouts instantly.
+
+#include <Kaleidoscope.h>
+
+#ifndef PPG_KLS_VIRTUAL_CLOCK_TICK
+#define PPG_KLS_VIRTUAL_CLOCK_TICK 1
+#endif
+
+namespace kaleidoscope {
+namespace papageno {
+namespace clock {
+
+#ifdef PPG_KLS_VIRTUAL_CLOCK
+
+extern uint16_t now_;
+
+inline
+uint16_t now()
+{
+   return now_;
+}
+
+inline
+void advance(uint16_t delta)
+{
+   now_ += delta;
+}
+
+inline
+void set(uint16_t time)
+{
+   now_ = time;
+}
+
+inline
+void tick()
+{
+   now_ += PPG_KLS_VIRTUAL_CLOCK_TICK;
+}
+
+#else
+
+inline
+uint16_t now()
+{
+   return static_cast<uint16_t>(millis());
+}
+
+inline
+void tick() {}
+
+#endif
+
+} // namespace clock
+} // namespace papageno
+} // namespace kaleidoscope
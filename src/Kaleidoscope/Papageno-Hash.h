@@ -0,0 +1,390 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// A perfect hash for a set of 16 bit keys that is computed
+// by the compiler (hash and displace).
+//
+// The keys are distributed to buckets by a first hash. For every bucket,
+// the compiler searches a seed for a second hash that maps the keys of
+// the bucket to table slots that are not yet occupied by keys of
+// previously placed buckets. A lookup thus costs two hash evaluations, 
+// two table reads and a single compare of the key.
+//
+// Buckets are placed in the order of decreasing size, as large buckets
+// are the hardest to place. There are as many buckets as slots. 
+// The number of slots is the smallest power of two that holds all keys, 
+// doubled (up to 128 slots) until seeds are found for all buckets. 
+// The hash is thus perfect but not minimal.
+//
+// Max_Keys is a tested limit. Seeds were found for each of 22400 random 
+// key sets, 100 sets of uniformly distributed keys and 100 sets of 
+// keycodes with modifiers for every size from 1 to Max_Keys. More keys 
+// fail a static assertion.
+//
+// All functions are C++11 constexpr. Every bucket is placed by a template
+// instantiation of its own, which keeps the recursion depth of the 
+// constexpr functions below the default limit of 512.
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace papageno {
+namespace hash {
+
+static constexpr unsigned Max_Keys = 112;
+static constexpr uint8_t Max_Slot_Bits = 7;
+static constexpr uint8_t No_Seed = 0xFF;
+
+constexpr uint8_t log2Ceil(unsigned n, uint8_t bits = 0)
+{
+   return ((1u << bits) >= n) ? bits : log2Ceil(n, bits + 1);
+}
+
+// Multiplicative hashing. Only the upper bits of the 16 bit product
+// are used. The arithmetic is the same on the host and on AVR.
+//
+constexpr uint8_t index(uint16_t key, uint8_t seed, uint8_t bits)
+{
+   return (bits == 0) ? 0
+      : (uint8_t)((uint16_t)((uint16_t)(key ^ (seed*0x3D65u)) * 40503u)
+                                                            >> (16 - bits));
+}
+
+// True if key does not occur in keys[i] to keys[n - 1]
+//
+constexpr bool unique(const uint16_t *keys, unsigned n, uint16_t key,
+                      unsigned i)
+{
+   return (i == n) || ((keys[i] != key) && unique(keys, n, key, i + 1));
+}
+
+constexpr bool distinct(const uint16_t *keys, unsigned n, unsigned i = 0)
+{
+   return (i == n) 
+      || (unique(keys, n, keys[i], i + 1) && distinct(keys, n, i + 1));
+}
+
+// A set of up to 128 slots
+//
+struct Slot_Mask {
+   
+   constexpr Slot_Mask(uint64_t low_ = 0, uint64_t high_ = 0)
+      : low(low_), high(high_) {}
+   
+   constexpr Slot_Mask with(uint8_t slot) const {
+      return (slot < 64) ? Slot_Mask(low | ((uint64_t)1 << slot), high)
+         : Slot_Mask(low, high | ((uint64_t)1 << (slot - 64)));
+   }
+   
+   constexpr bool contains(uint8_t slot) const {
+      return (slot < 64) ? (low & ((uint64_t)1 << slot)) != 0
+         : (high & ((uint64_t)1 << (slot - 64))) != 0;
+   }
+   
+   constexpr bool intersects(Slot_Mask other) const {
+      return ((low & other.low) | (high & other.high)) != 0;
+   }
+   
+   constexpr Slot_Mask operator|(Slot_Mask other) const {
+      return Slot_Mask(low | other.low, high | other.high);
+   }
+   
+   uint64_t low;
+   uint64_t high;
+};
+
+struct Occupancy {
+   constexpr Occupancy(bool ok_, Slot_Mask slots_) : ok(ok_), slots(slots_) {}
+   bool ok;
+   Slot_Mask slots;
+};
+
+// The slots that the keys of a bucket occupy for a given seed.
+// Not ok if two of the keys share a slot.
+//
+constexpr Occupancy bucketSlots(const uint16_t *keys, unsigned n,
+                            uint8_t bucket, uint8_t seed, uint8_t slot_bits,
+                            unsigned i = 0, Slot_Mask acc = Slot_Mask())
+{
+   return (i == n) ? Occupancy(true, acc)
+      : (index(keys[i], 0, slot_bits) != bucket)
+         ? bucketSlots(keys, n, bucket, seed, slot_bits, i + 1, acc)
+      : acc.contains(index(keys[i], seed, slot_bits))
+         ? Occupancy(false, Slot_Mask())
+      : bucketSlots(keys, n, bucket, seed, slot_bits, i + 1,
+                    acc.with(index(keys[i], seed, slot_bits)));
+}
+
+constexpr bool fits(Occupancy slots, Slot_Mask occupied)
+{
+   return slots.ok && !slots.slots.intersects(occupied);
+}
+
+constexpr uint8_t findSeed(const uint16_t *keys, unsigned n,
+                           uint8_t bucket, uint8_t slot_bits,
+                           Slot_Mask occupied, uint8_t seed = 0)
+{
+   return (seed == No_Seed) ? No_Seed
+      : fits(bucketSlots(keys, n, bucket, seed, slot_bits), occupied) ? seed
+      : findSeed(keys, n, bucket, slot_bits, occupied, seed + 1);
+}
+
+constexpr uint8_t bucketSize(const uint16_t *keys, unsigned n,
+                             uint8_t bucket, uint8_t slot_bits, 
+                             unsigned i = 0)
+{
+   return (i == n) ? 0
+      : (index(keys[i], 0, slot_bits) == bucket)
+            + bucketSize(keys, n, bucket, slot_bits, i + 1);
+}
+
+// The position of a bucket in the order of placement, i.e. the number
+// of buckets that are larger or that are of the same size but 
+// have a lower index
+//
+constexpr uint8_t bucketRank(const uint8_t *sizes, unsigned n_buckets,
+                             unsigned bucket, unsigned i = 0)
+{
+   return (i == n_buckets) ? 0
+      : (   (sizes[i] > sizes[bucket])
+         || ((sizes[i] == sizes[bucket]) && (i < bucket)))
+            + bucketRank(sizes, n_buckets, bucket, i + 1);
+}
+
+constexpr uint8_t bucketOfRank(const uint8_t *ranks, unsigned rank,
+                               uint8_t bucket = 0)
+{
+   return (ranks[bucket] == rank) ? bucket
+      : bucketOfRank(ranks, rank, bucket + 1);
+}
+
+// The slot table entry: one plus the index of the key 
+// that occupies the slot, 0 if the slot is empty
+//
+constexpr uint8_t slotEntry(const uint8_t *key_slots, unsigned n,
+                            uint8_t slot, unsigned i = 0)
+{
+   return (i == n) ? 0
+      : (key_slots[i] == slot) ? i + 1
+      : slotEntry(key_slots, n, slot, i + 1);
+}
+
+// A compile time sequence of indices to expand the tables
+// (there is no <utility> on avr-gcc)
+//
+template<unsigned... I__>
+struct Indices {};
+
+template<unsigned N__, unsigned... I__>
+struct Make_Indices : Make_Indices<N__ - 1, N__ - 1, I__...> {};
+
+template<unsigned... I__>
+struct Make_Indices<0, I__...> { typedef Indices<I__...> Type; };
+
+// The rank of every bucket in the order of placement
+//
+template<typename Keys__, uint8_t Slot_Bits__, typename Indices__> 
+struct Bucket_Ranks;
+
+template<typename Keys__, uint8_t Slot_Bits__, unsigned... I__>
+struct Bucket_Ranks<Keys__, Slot_Bits__, Indices<I__...> >
+{
+   static constexpr uint8_t sizes[sizeof...(I__)] = {
+      bucketSize(Keys__::keys, Keys__::n, I__, Slot_Bits__)...
+   };
+   
+   static constexpr uint8_t data[sizeof...(I__)] = {
+      bucketRank(sizes, sizeof...(I__), I__)...
+   };
+};
+
+template<typename Keys__, uint8_t Slot_Bits__, unsigned... I__>
+constexpr uint8_t 
+   Bucket_Ranks<Keys__, Slot_Bits__, Indices<I__...> >::sizes[sizeof...(I__)];
+
+template<typename Keys__, uint8_t Slot_Bits__, unsigned... I__>
+constexpr uint8_t 
+   Bucket_Ranks<Keys__, Slot_Bits__, Indices<I__...> >::data[sizeof...(I__)];
+
+template<typename Keys__, uint8_t Slot_Bits__>
+using Ranks = Bucket_Ranks<Keys__, Slot_Bits__,
+   typename Make_Indices<(1u << Slot_Bits__)>::Type>;
+
+// The placement of the buckets of rank 0 to Rank__ - 1. Every 
+// instantiation places a single bucket on top of the previous ones. 
+// Once a bucket cannot be placed, the seeds of all later ranks
+// are No_Seed.
+//
+template<typename Keys__, uint8_t Slot_Bits__, unsigned Rank__>
+struct Placement
+{
+   typedef Placement<Keys__, Slot_Bits__, Rank__ - 1> Previous;
+   
+   static constexpr uint8_t bucket
+      = bucketOfRank(Ranks<Keys__, Slot_Bits__>::data, Rank__ - 1);
+   
+   static constexpr uint8_t seed = (Previous::seed == No_Seed) ? No_Seed
+      : findSeed(Keys__::keys, Keys__::n, bucket, Slot_Bits__,
+                 Previous::occupied);
+   
+   static constexpr Slot_Mask occupied = (seed == No_Seed) ? Slot_Mask()
+      : Previous::occupied
+           | bucketSlots(Keys__::keys, Keys__::n, bucket, seed,
+                         Slot_Bits__).slots;
+};
+
+template<typename Keys__, uint8_t Slot_Bits__>
+struct Placement<Keys__, Slot_Bits__, 0>
+{
+   static constexpr uint8_t seed = 0;
+   static constexpr Slot_Mask occupied = Slot_Mask();
+};
+
+template<typename Keys__, uint8_t Slot_Bits__, unsigned Rank__>
+constexpr Slot_Mask Placement<Keys__, Slot_Bits__, Rank__>::occupied;
+
+template<typename Keys__, uint8_t Slot_Bits__>
+constexpr Slot_Mask Placement<Keys__, Slot_Bits__, 0>::occupied;
+
+template<typename Keys__, uint8_t Slot_Bits__>
+struct Feasible {
+   static constexpr bool value
+      = Placement<Keys__, Slot_Bits__, (1u << Slot_Bits__)>::seed != No_Seed;
+};
+
+// The smallest number of slot bits, starting from Slot_Bits__, for 
+// which all buckets can be placed. Max_Slot_Bits if there is none.
+//
+template<typename Keys__, uint8_t Slot_Bits__,
+         bool Done__ =    Feasible<Keys__, Slot_Bits__>::value
+                       || (Slot_Bits__ >= Max_Slot_Bits)>
+struct Slot_Bits {
+   static constexpr uint8_t value 
+      = Slot_Bits<Keys__, Slot_Bits__ + 1>::value;
+};
+
+template<typename Keys__, uint8_t Slot_Bits__>
+struct Slot_Bits<Keys__, Slot_Bits__, true> {
+   static constexpr uint8_t value = Slot_Bits__;
+};
+
+// The tables of the perfect hash of the keys that are defined by
+// Keys__, a class with the static constexpr members n (the number
+// of keys) and keys (the keys in PROGMEM).
+//
+template<typename Keys__>
+struct Parameters {
+   
+   static_assert(Keys__::n <= Max_Keys, "Too many keys for a perfect hash");
+   
+   static_assert(distinct(Keys__::keys, Keys__::n),
+                 "A key is defined twice");
+   
+   static constexpr uint8_t slot_bits 
+      = Slot_Bits<Keys__, log2Ceil(Keys__::n)>::value;
+   
+   // Duplicate keys can never be placed. They are reported above.
+   //
+   static_assert(   !distinct(Keys__::keys, Keys__::n)
+                 || Feasible<Keys__, slot_bits>::value,
+                 "No seeds found for a perfect hash of the keys");
+};
+
+template<typename Keys__, typename Indices__> struct Seeds;
+
+template<typename Keys__, unsigned... I__>
+struct Seeds<Keys__, Indices<I__...> >
+{
+   static constexpr uint8_t slot_bits = Parameters<Keys__>::slot_bits;
+   
+   static constexpr uint8_t data[sizeof...(I__)] PROGMEM = {
+      Placement<Keys__, slot_bits, 
+                Ranks<Keys__, slot_bits>::data[I__] + 1>::seed...
+   };
+};
+
+template<typename Keys__, unsigned... I__>
+constexpr uint8_t Seeds<Keys__, Indices<I__...> >::data[sizeof...(I__)];
+
+template<typename Keys__>
+using Bucket_Seeds = Seeds<Keys__, 
+   typename Make_Indices<(1u << Parameters<Keys__>::slot_bits)>::Type>;
+
+// The slot of every key
+//
+template<typename Keys__, typename Indices__> struct Key_Slots;
+
+template<typename Keys__, unsigned... I__>
+struct Key_Slots<Keys__, Indices<I__...> >
+{
+   static constexpr uint8_t data[sizeof...(I__) + 1] = {
+      index(Keys__::keys[I__], 
+            Bucket_Seeds<Keys__>::data[
+               index(Keys__::keys[I__], 0, Parameters<Keys__>::slot_bits)],
+            Parameters<Keys__>::slot_bits)...,
+      0
+   };
+};
+
+template<typename Keys__, unsigned... I__>
+constexpr uint8_t Key_Slots<Keys__, Indices<I__...> >::data[sizeof...(I__) + 1];
+
+template<typename Keys__, typename Indices__> struct Slots;
+
+template<typename Keys__, unsigned... I__>
+struct Slots<Keys__, Indices<I__...> >
+{
+   typedef Key_Slots<Keys__, typename Make_Indices<Keys__::n>::Type> 
+      Key_Slots_Type;
+   
+   static constexpr uint8_t data[sizeof...(I__)] PROGMEM = {
+      slotEntry(Key_Slots_Type::data, Keys__::n, I__)...
+   };
+};
+
+template<typename Keys__, unsigned... I__>
+constexpr uint8_t Slots<Keys__, Indices<I__...> >::data[sizeof...(I__)];
+
+template<typename Keys__>
+using Key_Table = Slots<Keys__, 
+   typename Make_Indices<(1u << Parameters<Keys__>::slot_bits)>::Type>;
+
+// Returns one plus the index of key in Keys__::keys or 0 if key 
+// is not part of the set.
+//
+template<typename Keys__>
+uint8_t lookup(uint16_t key)
+{
+   uint8_t seed = pgm_read_byte(&Bucket_Seeds<Keys__>::data[
+                        index(key, 0, Parameters<Keys__>::slot_bits)]);
+   
+   uint8_t entry = pgm_read_byte(&Key_Table<Keys__>::data[
+                        index(key, seed, Parameters<Keys__>::slot_bits)]);
+   
+   if((entry == 0) || (pgm_read_word(&Keys__::keys[entry - 1]) != key)) {
+      return 0;
+   }
+   
+   return entry;
+}
+
+} // namespace hash
+} // namespace papageno
+} // namespace kaleidoscope
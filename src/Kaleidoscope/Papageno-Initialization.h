@@ -22,6 +22,9 @@
 
 #include <assert.h>
 
+#include <Kaleidoscope/Papageno-Telemetry.h>
+#include <Kaleidoscope/Papageno-Hash.h>
+
 // A note on the use of the __NL__ macro below:
 //
 //       Preprocessor macro functions can be 
@@ -49,53 +52,96 @@
 #define __NL__
 #define __NN__
 
+// Sketches that do not define inputs of a type might not
+// cause the respective input list to be generated.
+//
+#ifndef GLS_INPUTS___KEYCODE
+#define GLS_INPUTS___KEYCODE(OP)
+#endif
+
+#ifndef GLS_INPUTS___COMPLEX_KEYCODE
+#define GLS_INPUTS___COMPLEX_KEYCODE(OP)
+#endif
+
 namespace kaleidoscope {
 namespace papageno {
 
+// The raw value of a key. Reading Key::raw is a constant expression
+// only for keys that have been constructed from a raw value, reading
+// keyCode and flags only for keys that have been constructed from those.
+// The compiler tells both apart while it evaluates the constant.
+// Both AVR and host builds are little endian.
+//
+constexpr uint16_t keyRaw(Key key)
+{
+   return (__builtin_constant_p(key.raw)) 
+            ? key.raw 
+            : (uint16_t)((key.flags << 8) | key.keyCode);
+}
+
 // The inputs that are defined by Papageno in the firmware sketch
 // are mapped to a range of compile time constants whose value starts from 
-// zero.
+// zero. Keypos inputs come first, followed by keycode inputs.
 //
-// To allow for automatic numbering, we use the __COUNTER__ macro. 
-// This macro returns a consecutive set of integer numbers starting from
-// zero. It is is important to note that __COUNTER__ is not uniqe for a 
-// given include file but for the overall compilation unit. That's 
-// why we have to define an offset to make sure that our input ids actually
-// start from zero.
+// The tables that depend on the inputs are either expanded from
+// the input lists that Glockenspiel generates, or, if PPG_KLS_PLAIN_TABLES
+// is defined, read from literal C++ code that tools/papageno-plain-tables.py 
+// writes. Both define the same entities with the same values.
 //
-static constexpr unsigned PPG_Keypos_Input_Offset = __COUNTER__;
+#ifdef PPG_KLS_PLAIN_TABLES
 
-#define PPG_KLS_DEFINE_KEYPOS_INPUT_ID(UNIQUE_ID, USER_ID, ROW, COL)                           \
-__NL__   static constexpr unsigned PPG_KLS_KEYPOS_INPUT(UNIQUE_ID)                    \
-__NL__               = __COUNTER__ - PPG_Keypos_Input_Offset - 1;
+#include "Kaleidoscope-Papageno-Tables.hpp"
 
-GLS_INPUTS___KEYPOS(PPG_KLS_DEFINE_KEYPOS_INPUT_ID)
+#else
 
-// Attention! PPG_Highest_Keypos_Input may be negative in case
-// that no keypos inputs are defined
+// The ids are the enumerators of a plain enum. This requires only a 
+// single expansion of the input list. The ids are implicit enumerators, 
+// i.e. their values do not appear in the preprocessed code. 
+// Use the plain table mode to obtain them literally.
 //
-static constexpr int16_t PPG_Highest_Keypos_Input
-           = (int16_t)(__COUNTER__) - PPG_Keypos_Input_Offset - 2 ;
-           
-static_assert(PPG_Highest_Keypos_Input >= 0, "PPG_Highest_Keypos_Input negative");
+enum PPG_KLS_Input_Ids {
 
-int16_t highestKeyposInputId() {
-   return PPG_Highest_Keypos_Input;
-}
+#  define PPG_KLS_DEFINE_KEYPOS_INPUT_ID(UNIQUE_ID, USER_ID, ROW, COL)         \
+__NL__   PPG_KLS_KEYPOS_INPUT(UNIQUE_ID),
 
-static constexpr unsigned PPG_Keycode_Input_Offset = __COUNTER__;
+   GLS_INPUTS___KEYPOS(PPG_KLS_DEFINE_KEYPOS_INPUT_ID)
+   
+   // The number of keypos inputs
+   //
+   PPG_KLS_N_Keypos_Inputs,
+   
+   // Makes the first keycode input follow the last keypos input
+   //
+   PPG_KLS_Keycode_Inputs_Base = PPG_KLS_N_Keypos_Inputs - 1,
+   
+#  define PPG_KLS_DEFINE_KEYCODE_INPUT_ID(UNIQUE_ID, USER_ID)                  \
+__NL__   PPG_KLS_KEYCODE_INPUT(UNIQUE_ID),
 
-// To attach to Kaleidoscope's event handling, we 
-// need to be able to determine an input id from a keypos.
+#  define PPG_KLS_DEFINE_COMPLEX_KEYCODE_INPUT_ID(UNIQUE_ID, USER_ID, ...)     \
+__NL__   PPG_KLS_KEYCODE_INPUT(UNIQUE_ID),
+
+   GLS_INPUTS___KEYCODE(PPG_KLS_DEFINE_KEYCODE_INPUT_ID)
+   GLS_INPUTS___COMPLEX_KEYCODE(PPG_KLS_DEFINE_COMPLEX_KEYCODE_INPUT_ID)
+   
+   // The number of all inputs
+   //
+   PPG_KLS_N_Inputs_End
+};
+
+static constexpr unsigned PPG_KLS_N_Input_Bytes 
+   = (GLS_NUM_BITS_LEFT(PPG_KLS_N_Inputs_End) != 0) 
+         ? (GLS_NUM_BYTES(PPG_KLS_N_Inputs_End) + 1) 
+         : GLS_NUM_BYTES(PPG_KLS_N_Inputs_End);
+
+// The switch is done on the matrix index of the key (see keyposIndex) 
+// which is a single byte on boards with at most 256 keys.
 //
-PPG_Input_Id inputIdFromKeypos(byte row, byte col)
+PPG_Input_Id inputIdFromKeyposIndex(PPG_KLS_Keypos_Index index)
 {
-   uint16_t id = 256*row + col;
-
-   switch(id) {
+   switch(index) {
    
 #     define PPG_KLS_KEYPOS_CASE_LABEL(UNIQUE_ID, USER_ID, ROW, COL)                           \
-__NL__   case 256*ROW + COL:                                                   \
+__NL__   case ROW*COLS + COL:                                                  \
 __NL__      return PPG_KLS_KEYPOS_INPUT(UNIQUE_ID);                                   \
 __NL__      break;
 
@@ -105,6 +151,32 @@ __NL__      break;
    return PPG_KLS_Not_An_Input;
 }
 
+// The keycodes of keycode inputs, in the order of their input ids.
+// They are looked up via a perfect hash that is computed 
+// by the compiler (see Papageno-Hash.h).
+//
+struct PPG_KLS_Keycode_Inputs {
+   
+   static constexpr unsigned n = PPG_KLS_N_Inputs_End - PPG_KLS_N_Keypos_Inputs;
+   
+   static constexpr uint16_t keys[n + 1] PROGMEM = {
+
+#     define PPG_KLS_KEYCODE_INPUT_RAW(UNIQUE_ID, USER_ID)                     \
+__NL__   keyRaw(USER_ID),
+
+#     define PPG_KLS_COMPLEX_KEYCODE_INPUT_RAW(UNIQUE_ID, USER_ID, ...)        \
+__NL__   keyRaw(__VA_ARGS__),
+
+      GLS_INPUTS___KEYCODE(PPG_KLS_KEYCODE_INPUT_RAW)
+      GLS_INPUTS___COMPLEX_KEYCODE(PPG_KLS_COMPLEX_KEYCODE_INPUT_RAW)
+      
+      0 // Prevents an empty array
+   };
+};
+
+// The key positions of keypos inputs. Keycode inputs have no fixed
+// key position (see keycodeInputKeypos).
+//
 PPG_KLS_Keypos ppg_kls_keypos_lookup[] = {
 
 #  define PPG_KLS_KEYPOS_TO_LOOKUP_ENTRY(UNIQUE_ID, USER_ID, ROW, COL)                         \
@@ -115,31 +187,184 @@ PPG_KLS_Keypos ppg_kls_keypos_lookup[] = {
    { .row = 0xFF, .col = 0xFFL }
 };
 
-#define PPG_KLS_ADD_ONE(...) + 1
+#endif // PPG_KLS_PLAIN_TABLES
+
+static constexpr unsigned PPG_KLS_N_Inputs = PPG_KLS_N_Inputs_End;
+
+static constexpr unsigned PPG_KLS_N_Keycode_Inputs 
+   = PPG_KLS_N_Inputs - PPG_KLS_N_Keypos_Inputs;
+
+// Attention! PPG_Highest_Keypos_Input may be negative in case
+// that no keypos inputs are defined
+//
+static constexpr int16_t PPG_Highest_Keypos_Input
+           = (int16_t)PPG_KLS_N_Keypos_Inputs - 1;
+           
+static_assert(PPG_KLS_N_Inputs > 0, "No inputs defined");
+
+// Input ids are compared with highestKeyposInputId() to tell 
+// keypos and keycode inputs apart
+//
+static_assert(PPG_Highest_Keypos_Input >= 0, "PPG_Highest_Keypos_Input negative");
+
+static_assert(PPG_KLS_N_Inputs < (unsigned)PPG_KLS_Not_An_Input,
+              "Too many inputs for the width of PPG_Input_Id");
+
+static_assert(PPG_KLS_N_Keycode_Inputs <= hash::Max_Keys,
+              "Too many keycode inputs, at most 112 are supported");
 
-static constexpr unsigned PPG_KLS_N_Inputs = 0
-   GLS_INPUTS___KEYPOS(PPG_KLS_ADD_ONE)
-//    GLS_INPUTS___KEYCODE(PPG_KLS_ADD_ONE)
-//    GLS_INPUTS___COMPLEX_KEYCODE(PPG_KLS_ADD_ONE)
-;
+int16_t highestKeyposInputId() {
+   return PPG_Highest_Keypos_Input;
+}
+
+PPG_Input_Id numberOfInputs() {
+   return PPG_KLS_N_Inputs;
+}
 
-PPG_Bitfield_Storage_Type inputsBlockedBits[(GLS_NUM_BITS_LEFT(PPG_KLS_N_Inputs) != 0) ? (GLS_NUM_BYTES(PPG_KLS_N_Inputs) + 1) : GLS_NUM_BYTES(PPG_KLS_N_Inputs)]
+// To attach to Kaleidoscope's event handling, we 
+// need to be able to determine an input id from a keypos.
+//
+PPG_Input_Id inputIdFromKeypos(byte row, byte col)
+{
+   // Injected events e.g. come with an unknown keyswitch location
+   // that would otherwise alias a valid matrix index.
+   //
+   if((row >= ROWS) || (col >= COLS)) {
+      return PPG_KLS_Not_An_Input;
+   }
+
+   return inputIdFromKeyposIndex(keyposIndex(row, col));
+}
+
+constexpr uint16_t PPG_KLS_Keycode_Inputs::keys[];
+
+// Keycode inputs are resolved when their key is pressed. The input
+// is recorded for the key position, so that a layer change while the key 
+// is held does not change the input of its release. Entries hold 
+// the input id plus one, zero meaning none. 
+//
+static constexpr unsigned PPG_KLS_N_Keycode_Input_Keyposes
+   = (PPG_KLS_N_Keycode_Inputs > 0) ? ROWS*COLS : 1;
+   
+PPG_Input_Id keycodeInputOfKeypos[PPG_KLS_N_Keycode_Input_Keyposes]
+   = GLS_ZERO_INIT;
+
+// Marks key positions whose press has been flushed and whose release
+// is yet to be flushed.
+//
+PPG_Bitfield_Storage_Type keycodeInputFlushedBits
+   [(PPG_KLS_N_Keycode_Input_Keyposes + 7)/8] = GLS_ZERO_INIT;
+   
+PPG_Bitfield keycodeInputFlushed 
+   = { keycodeInputFlushedBits, PPG_KLS_N_Keycode_Input_Keyposes };
+
+PPG_Input_Id inputIdFromKeycode(Key keycode, byte row, byte col, 
+                                uint8_t key_state)
+{
+   if(PPG_KLS_N_Keycode_Inputs == 0) {
+      return PPG_KLS_Not_An_Input;
+   }
+   
+   // Injected events come without a key position. They are 
+   // resolved by their keycode only.
+   //
+   bool onMatrix = (row < ROWS) && (col < COLS);
+   
+   if(onMatrix && !keyToggledOn(key_state)) {
+      
+      PPG_Input_Id entry = keycodeInputOfKeypos[keyposIndex(row, col)];
+      
+      return (entry == 0) ? (PPG_Input_Id)PPG_KLS_Not_An_Input : entry - 1;
+   }
+   
+   uint8_t entry = hash::lookup<PPG_KLS_Keycode_Inputs>(keycode.raw);
+   
+   if(onMatrix) {
+      
+      PPG_KLS_Keypos_Index index = keyposIndex(row, col);
+      
+      keycodeInputOfKeypos[index] 
+         = (entry == 0) ? 0 : PPG_KLS_N_Keypos_Inputs + entry;
+      ppg_bitfield_set_bit(&keycodeInputFlushed, index, false);
+   }
+   
+   if(entry == 0) {
+      return PPG_KLS_Not_An_Input;
+   }
+   
+   return PPG_KLS_N_Keypos_Inputs + entry - 1;
+}
+
+// When events of keycode inputs are flushed, they are replayed 
+// at a key position where the input was pressed. Several keys
+// may cause the same input. A press is paired with a key whose press 
+// was not yet flushed, a release with one whose press was.
+//
+bool keycodeInputKeypos(PPG_Input_Id input, bool pressed, 
+                        PPG_KLS_Keypos *keypos)
+{
+   if(PPG_KLS_N_Keycode_Inputs == 0) { return false; }
+   
+   for(uint16_t index = 0; index < PPG_KLS_N_Keycode_Input_Keyposes; 
+       ++index) {
+      
+      if(keycodeInputOfKeypos[index] != input + 1) { continue; }
+      
+      if(ppg_bitfield_get_bit(&keycodeInputFlushed, index) == pressed) {
+         continue;
+      }
+      
+      ppg_bitfield_set_bit(&keycodeInputFlushed, index, pressed);
+      
+      keypos->row = index / COLS;
+      keypos->col = index % COLS;
+      
+      return true;
+   }
+   
+   return false;
+}
+
+Key keyFromKeycodeInput(PPG_Input_Id input)
+{
+   Key key;
+   key.raw = pgm_read_word(
+      &PPG_KLS_Keycode_Inputs::keys[input - PPG_KLS_N_Keypos_Inputs]);
+   return key;
+}
+
+PPG_Bitfield_Storage_Type inputsBlockedBits[PPG_KLS_N_Input_Bytes]
    = GLS_ZERO_INIT;
    
 PPG_Bitfield inputsBlocked = { inputsBlockedBits, PPG_KLS_N_Inputs };
    
-void blockInput(uint8_t inputId) {
+void blockInput(PPG_Input_Id inputId) {
    ppg_bitfield_set_bit(&inputsBlocked, inputId, true);
 }
 
-void unblockInput(uint8_t inputId) {
+void unblockInput(PPG_Input_Id inputId) {
    ppg_bitfield_set_bit(&inputsBlocked, inputId, false);
 }
 
-bool isInputBlocked(uint8_t inputId) {
+bool isInputBlocked(PPG_Input_Id inputId) {
    return ppg_bitfield_get_bit(&inputsBlocked, inputId);
 }
 
+#ifdef PPG_KLS_TELEMETRY_ENABLED
+namespace telemetry {
+
+// Zero initialized as a static
+//
+PPG_KLS_Input_Counters ppg_kls_input_counters[PPG_KLS_N_Inputs];
+
+// Action ids count from the first action initializer that
+// follows (see PPG_KLS_ACTION_CALLBACK)
+//
+static constexpr uint16_t PPG_KLS_Action_Id_Base = __COUNTER__;
+
+} // namespace telemetry
+#endif
+
 // int8_t inputsBlocked[PPG_KLS_N_Inputs] = GLS_ZERO_INIT;
 // 
 // void blockInput(uint8_t inputId) {
@@ -0,0 +1,60 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <Kaleidoscope/Papageno-Log.h>
+
+#if PPG_KLS_LOG_LEVEL > 0
+
+namespace kaleidoscope {
+namespace papageno {
+namespace log {
+
+PPG_KLS_Ring<PPG_KLS_Log_Record, PPG_KLS_LOG_BUFFER_SIZE> ring_;
+uint16_t dropped_ = 0;
+
+bool focusHook(const char *command)
+{
+   if(strcmp_P(command, PSTR("papageno.log")) != 0) {
+      return false;
+   }
+
+   Serial.println(dropped_);
+   dropped_ = 0;
+
+   PPG_KLS_Log_Record record;
+
+   while(ring_.pop(record)) {
+      Serial.print(record.id);
+      Serial.print(" ");
+      Serial.print(record.arg0);
+      Serial.print(" ");
+      Serial.print(record.time);
+      Serial.print(" ");
+      Serial.print(record.arg1);
+      Serial.print(" ");
+      Serial.println(record.arg2);
+   }
+
+   return true;
+}
+
+} // namespace log
+} // namespace papageno
+} // namespace kaleidoscope
+
+#endif
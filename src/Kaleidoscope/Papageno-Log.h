@@ -0,0 +1,142 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Structured binary logging
+//
+// Every log call site writes a fixed size record of 8 bytes to a ring
+// buffer. A record holds the event id, a 16 bit timestamp and three
+// integer arguments, the first of which is a byte and the others
+// 16 bit words (see PPG_KLS_Log_Record).
+// The ring buffer is drained via the Focus hook "papageno.log" and
+// decoded on the host by tools/papageno-log-decode.py.
+//
+// Log statements are filtered at compile time by level and category.
+// Filtered statements are removed entirely by the compiler,
+// their arguments are not evaluated.
+//
+// PPG_KLS_LOG_LEVEL        highest level that is logged
+//                          (default: 0, logging disabled)
+// PPG_KLS_LOG_CATEGORIES   bitmask of enabled categories
+//                          (default: all)
+// PPG_KLS_LOG_BUFFER_SIZE  number of records in the ring buffer,
+//                          a power of two (default: 16)
+
+#include <Kaleidoscope/Papageno-Clock.h>
+#include <Kaleidoscope/Papageno-Queue.h>
+
+#define PPG_KLS_LOG_LEVEL_ERROR     1
+#define PPG_KLS_LOG_LEVEL_WARNING   2
+#define PPG_KLS_LOG_LEVEL_INFO      3
+#define PPG_KLS_LOG_LEVEL_DEBUG     4
+
+#define PPG_KLS_LOG_CATEGORY_EVENTS    0x01
+#define PPG_KLS_LOG_CATEGORY_SIGNALS   0x02
+#define PPG_KLS_LOG_CATEGORY_ACTIONS   0x04
+#define PPG_KLS_LOG_CATEGORY_LOOP      0x08
+
+#ifndef PPG_KLS_LOG_LEVEL
+#define PPG_KLS_LOG_LEVEL 0
+#endif
+
+#ifndef PPG_KLS_LOG_CATEGORIES
+#define PPG_KLS_LOG_CATEGORIES 0xFF
+#endif
+
+#ifndef PPG_KLS_LOG_BUFFER_SIZE
+#define PPG_KLS_LOG_BUFFER_SIZE 16
+#endif
+
+namespace kaleidoscope {
+namespace papageno {
+namespace log {
+
+// Event ids. Keep in sync with tools/papageno-log-decode.py
+//
+enum {
+   PPG_KLS_Log_Key = 1,       // key_state, row << 8 | col, keycode
+   PPG_KLS_Log_Feed,          // flags, input, time
+   PPG_KLS_Log_Flush,         // key_state, input, row << 8 | col
+   PPG_KLS_Log_Signal,        // signal id, -, -
+   PPG_KLS_Log_Abort,         // events flushed, row << 8 | col, keycode
+   PPG_KLS_Log_Passthrough,   // -, input, -
+   PPG_KLS_Log_Bad_State,     // -, input, -
+   PPG_KLS_Log_Keycode_Action,// key_state, keycode, -
+   PPG_KLS_Log_Keypos_Action, // key_state, row << 8 | col, -
+   PPG_KLS_Log_Loop,          // -, active tokens, buffered events
+   PPG_KLS_Log_Macro_Dropped  // queued macros, sequence address, -
+};
+
+typedef struct {
+   uint8_t id;
+   uint8_t arg0;
+   uint16_t time;
+   uint16_t arg1;
+   uint16_t arg2;
+} PPG_KLS_Log_Record;
+
+static_assert((PPG_KLS_LOG_BUFFER_SIZE & (PPG_KLS_LOG_BUFFER_SIZE - 1)) == 0,
+              "PPG_KLS_LOG_BUFFER_SIZE must be a power of two");
+
+// The ring buffer has exactly one producer (the firmware) and one
+// consumer (the Focus hook), both running in the main loop.
+// Records that do not fit are dropped and counted.
+//
+extern PPG_KLS_Ring<PPG_KLS_Log_Record, PPG_KLS_LOG_BUFFER_SIZE> ring_;
+extern uint16_t dropped_;
+
+inline
+void write(uint8_t id, uint8_t arg0, uint16_t arg1, uint16_t arg2)
+{
+   PPG_KLS_Log_Record record;
+   record.id = id;
+   record.arg0 = arg0;
+   record.time = clock::now();
+   record.arg1 = arg1;
+   record.arg2 = arg2;
+
+   if(!ring_.push(record)) {
+      if(dropped_ != 0xFFFF) { ++dropped_; }
+   }
+}
+
+// Focus hook "papageno.log". Prints the number of dropped records
+// followed by one line "id arg0 time arg1 arg2" per buffered record
+// and empties the buffer.
+//
+bool focusHook(const char *command);
+
+} // namespace log
+} // namespace papageno
+} // namespace kaleidoscope
+
+#if PPG_KLS_LOG_LEVEL > 0
+#define PPG_KLS_LOG_EVENT(LEVEL, CATEGORY, EVENT, ARG0, ARG1, ARG2)            \
+   do {                                                                        \
+      if(   (PPG_KLS_LOG_LEVEL >= PPG_KLS_LOG_LEVEL_##LEVEL)                   \
+         && (PPG_KLS_LOG_CATEGORIES & PPG_KLS_LOG_CATEGORY_##CATEGORY)) {      \
+         kaleidoscope::papageno::log::write(                                   \
+            kaleidoscope::papageno::log::PPG_KLS_Log_##EVENT,                  \
+            (uint8_t)(ARG0), (uint16_t)(ARG1), (uint16_t)(ARG2));              \
+      }                                                                        \
+   } while(0)
+#else
+#define PPG_KLS_LOG_EVENT(LEVEL, CATEGORY, EVENT, ARG0, ARG1, ARG2)            \
+   do {} while(0)
+#endif
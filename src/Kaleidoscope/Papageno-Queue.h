@@ -0,0 +1,96 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Kaleidoscope.h>
+
+namespace kaleidoscope {
+namespace papageno {
+
+// A fixed capacity ring buffer with a single producer and
+// a single consumer. The producer only modifies head_, the
+// consumer only modifies tail_.
+//
+// The ring is not synchronized. Producer and consumer must run
+// on the same thread, as the event handler and Papageno::loop() do.
+// It must not be used from interrupt handlers.
+//
+// One slot is kept free to distinguish a full from an empty ring.
+// The number of slots must be a power of two.
+//
+template<typename Entry__, uint8_t Slots__>
+class PPG_KLS_Ring
+{
+   static_assert((Slots__ & (Slots__ - 1)) == 0,
+                 "The number of ring slots must be a power of two");
+
+   public:
+
+      bool empty() const { return head_ == tail_; }
+
+      bool full() const {
+         return ((head_ + 1) & (Slots__ - 1)) == tail_;
+      }
+
+      uint8_t size() const {
+         return (head_ - tail_) & (Slots__ - 1);
+      }
+
+      static constexpr uint8_t capacity() { return Slots__ - 1; }
+
+      // Returns false if the ring is full
+      //
+      bool push(const Entry__ &entry) {
+
+         uint8_t head = head_;
+         uint8_t next = (head + 1) & (Slots__ - 1);
+
+         if(next == tail_) { return false; }
+
+         entries_[head] = entry;
+         head_ = next;
+
+         return true;
+      }
+
+      // Returns false if the ring is empty
+      //
+      bool pop(Entry__ &entry) {
+
+         uint8_t tail = tail_;
+
+         if(tail == head_) { return false; }
+
+         entry = entries_[tail];
+         tail_ = (tail + 1) & (Slots__ - 1);
+
+         return true;
+      }
+
+      void clear() { tail_ = head_; }
+
+   private:
+
+      Entry__ entries_[Slots__];
+      uint8_t head_ = 0;
+      uint8_t tail_ = 0;
+};
+
+} // namespace papageno
+} // namespace kaleidoscope
@@ -0,0 +1,209 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+
+#include <Kaleidoscope/Papageno-Sequences.h>
+#include <Kaleidoscope/KPapageno.hpp>
+#include <Kaleidoscope/Papageno-Clock.h>
+
+namespace kaleidoscope {
+namespace papageno {
+namespace sequences {
+
+static const PPG_KLS_Sequence_Automaton *automaton_ = NULL;
+
+static const PPG_KLS_Sequence_State *states_ = NULL;
+static const PPG_KLS_Sequence_Edge *edges_ = NULL;
+
+static uint16_t state_ = 0;
+static uint16_t lastKeyTime_ = 0;
+
+// Keys whose press was consumed by the automaton. Their further events
+// are consumed as well, even after the automaton was disarmed.
+//
+static uint8_t swallowed_[(ROWS*COLS + 7)/8];
+
+static bool isSwallowed(PPG_KLS_Keypos_Index index)
+{
+   return swallowed_[index >> 3] & (1 << (index & 0x07));
+}
+
+static void setSwallowed(PPG_KLS_Keypos_Index index, bool state)
+{
+   if(state) {
+      swallowed_[index >> 3] |= (1 << (index & 0x07));
+   }
+   else {
+      swallowed_[index >> 3] &= ~(1 << (index & 0x07));
+   }
+}
+
+static uint16_t output(uint16_t state)
+{
+   return pgm_read_word(&states_[state].output);
+}
+
+static uint8_t nEdges(uint16_t state)
+{
+   return pgm_read_byte(&states_[state].n_edges);
+}
+
+// Returns the target of the edge of state that is labeled with symbol
+// or 0 if there is no such edge. As the root is never the target
+// of an edge, 0 is safe to signal a missing edge.
+//
+static uint16_t findEdge(uint16_t state, uint16_t symbol)
+{
+   uint16_t edge = pgm_read_word(&states_[state].first_edge);
+   uint8_t n_edges = nEdges(state);
+
+   for(uint8_t i = 0; i < n_edges; ++i, ++edge) {
+      if(pgm_read_word(&edges_[edge].symbol.raw) == symbol) {
+         return pgm_read_word(&edges_[edge].target);
+      }
+   }
+
+   return 0;
+}
+
+static void disarm()
+{
+   automaton_ = NULL;
+   state_ = 0;
+}
+
+static void trigger(uint16_t output)
+{
+   const PPG_KLS_Sequence_Action *action
+      = (const PPG_KLS_Sequence_Action *)pgm_read_ptr(&automaton_->actions)
+                                                            + (output - 1);
+
+   PPG_Action_Callback_Fun func
+      = (PPG_Action_Callback_Fun)pgm_read_ptr(&action->func);
+   void *user_data = pgm_read_ptr(&action->user_data);
+
+   disarm();
+
+   func(PPG_Action_Activation_Flags_Active, user_data);
+   func(0, user_data);
+}
+
+void arm(const PPG_KLS_Sequence_Automaton *automaton)
+{
+   automaton_ = automaton;
+   states_ = (const PPG_KLS_Sequence_State *)pgm_read_ptr(&automaton->states);
+   edges_ = (const PPG_KLS_Sequence_Edge *)pgm_read_ptr(&automaton->edges);
+   state_ = 0;
+   lastKeyTime_ = clock::now();
+}
+
+bool armed()
+{
+   return automaton_ != NULL;
+}
+
+// Returns false if the symbol was not consumed. This is the case if
+// it completed a sequence that is the prefix of a longer one by not
+// continuing the longer one. 
+//
+static bool step(uint16_t symbol)
+{
+   uint16_t target = findEdge(state_, symbol);
+
+   // A sequence that is a prefix of a longer one matches as soon as
+   // the longer one is not continued. The automaton is disarmed
+   // by the match, the key is thus processed as if it was not armed.
+   //
+   if((target == 0) && (output(state_) != 0)) {
+      trigger(output(state_));
+      return false;
+   }
+
+   // Follow the failure links to the longest suffix of the keys
+   // entered so far that can be continued with the symbol.
+   //
+   uint16_t state = state_;
+
+   while((target == 0) && (state != 0)) {
+      state = pgm_read_word(&states_[state].failure);
+      target = findEdge(state, symbol);
+   }
+
+   state_ = target;
+
+   if((output(state_) != 0) && (nEdges(state_) == 0)) {
+      trigger(output(state_));
+   }
+
+   return true;
+}
+
+bool processKeyEvent(Key keycode, byte row, byte col, uint8_t key_state)
+{
+   if((row >= ROWS) || (col >= COLS)) {
+      return false;
+   }
+
+   PPG_KLS_Keypos_Index index = keyposIndex(row, col);
+
+   if(automaton_ && keyToggledOn(key_state)) {
+
+      lastKeyTime_ = clock::now();
+
+      if(!step(keycode.raw)) {
+         return false;
+      }
+
+      setSwallowed(index, true);
+
+      return true;
+   }
+
+   if(!isSwallowed(index)) {
+      return false;
+   }
+
+   if(keyToggledOff(key_state)) {
+      setSwallowed(index, false);
+   }
+
+   return true;
+}
+
+void checkTimeout()
+{
+   if(!automaton_) { return; }
+
+   uint16_t timeout = pgm_read_word(&automaton_->timeout);
+
+   if((uint16_t)(clock::now() - lastKeyTime_) < timeout) {
+      return;
+   }
+
+   if(output(state_) != 0) {
+      trigger(output(state_));
+   }
+   else {
+      disarm();
+   }
+}
+
+} // namespace sequences
+} // namespace papageno
+} // namespace kaleidoscope
@@ -0,0 +1,108 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Leader sequences matched by an Aho-Corasick automaton
+//
+// The automaton is independent of the Papageno pattern tree. Sequences
+// that are defined in the sketch, e.g. as sequence strings, are part
+// of the tree and are not matched by the automaton.
+//
+// A set of key sequences is compiled by tools/papageno-sequences.py
+// into a goto/failure table that resides in PROGMEM. Once the automaton
+// is armed by an action (see Papageno::leadSequences), every key press
+// follows one edge of the goto table. Keys that do not continue
+// the current sequence first follow failure links to the longest suffix 
+// that is the prefix of another sequence instead of restarting from 
+// scratch. Nothing is buffered or flushed.
+//
+// The edges of a state are searched linearly. The cost of a key press 
+// thus grows with the number of keys that continue the states visited 
+// and with the number of failure links followed, which is bounded 
+// by the length of the longest sequence. It does not depend on the 
+// number of sequences otherwise.
+//
+// Sequences are made of keycodes, i.e. the keys as they are mapped
+// by the active layers. While the automaton is armed, all key events
+// are swallowed. The automaton is disarmed when a sequence matched or
+// when no key was pressed for the timeout of the automaton.
+//
+// A sequence that is the prefix of another one matches when the next
+// key does not continue the longer sequence or when the timeout expires.
+// In the former case, the next key is not consumed but processed
+// as usual after the action was triggered.
+
+#include <Kaleidoscope.h>
+
+extern "C" {
+#include "papageno.h"
+}
+
+namespace kaleidoscope {
+namespace papageno {
+
+// The transitions of a state. The edges of a state are stored
+// consecutively.
+//
+typedef struct {
+   Key symbol;
+   uint16_t target;
+} PPG_KLS_Sequence_Edge;
+
+typedef struct {
+   uint16_t failure;    // state to fall back to if no edge matches
+   uint16_t first_edge;
+   uint8_t n_edges;
+   uint16_t output;     // 1 + index of the action, 0 if none
+} PPG_KLS_Sequence_State;
+
+// Actions are triggered like a tap, i.e. once with
+// PPG_Action_Activation_Flags_Active and once without.
+//
+typedef struct {
+   PPG_Action_Callback_Fun func;
+   void *user_data;
+} PPG_KLS_Sequence_Action;
+
+typedef struct {
+   const PPG_KLS_Sequence_State *states;  // state 0 is the root
+   const PPG_KLS_Sequence_Edge *edges;
+   const PPG_KLS_Sequence_Action *actions;
+   uint16_t timeout;                      // ms
+} PPG_KLS_Sequence_Automaton;
+
+namespace sequences {
+
+// Arms the automaton, whose definition must reside in PROGMEM.
+//
+void arm(const PPG_KLS_Sequence_Automaton *automaton);
+
+bool armed();
+
+// Returns true if the key event was consumed by the automaton.
+//
+bool processKeyEvent(Key keycode, byte row, byte col, uint8_t key_state);
+
+// Disarms the automaton if the timeout expired.
+//
+void checkTimeout();
+
+} // namespace sequences
+} // namespace papageno
+} // namespace kaleidoscope
@@ -0,0 +1,286 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Note: We define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+//       here to suppress inclusion of the Papageno/Glockenspiel
+//       generated C/C++ code.
+//
+#define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+#include <Kaleidoscope/Papageno-Storage.h>
+
+#ifdef PPG_KLS_STORAGE_ENABLED
+
+#include <Kaleidoscope-EEPROM-Settings.h>
+
+namespace kaleidoscope {
+namespace papageno {
+namespace storage {
+
+static uint16_t base_ = 0;
+static bool valid_ = false;
+
+inline
+static uint8_t readByte(uint16_t offset)
+{
+   return EEPROM.read(base_ + offset);
+}
+
+inline
+static uint16_t readWord(uint16_t offset)
+{
+   return (uint16_t)readByte(offset)
+        | ((uint16_t)readByte(offset + 1) << 8);
+}
+
+static uint16_t actionRecordsOffset()
+{
+   return PPG_KLS_Storage_Header_Size
+            + readByte(3)*PPG_KLS_Storage_Input_Record_Size;
+}
+
+static bool validKeypos(uint8_t row, uint8_t col)
+{
+   return (row < ROWS) && (col < COLS);
+}
+
+static bool validAction(uint8_t kind, uint16_t value)
+{
+   switch(kind) {
+      case PPG_KLS_Binding_Keycode:
+         return true;
+      case PPG_KLS_Binding_Keypos:
+         return validKeypos(value >> 8, value & 0xFF);
+   }
+
+   return false;
+}
+
+static bool validate()
+{
+   if(   (readByte(0) != 'P')
+      || (readByte(1) != 'G')
+      || (readByte(2) != PPG_KLS_Storage_Version)) {
+      return false;
+   }
+
+   uint16_t end = actionRecordsOffset()
+                     + readByte(4)*PPG_KLS_Storage_Action_Record_Size;
+
+   if(end > PPG_KLS_STORAGE_SIZE) {
+      return false;
+   }
+
+   uint8_t checksum = 0;
+   for(uint16_t i = PPG_KLS_Storage_Header_Size; i < end; ++i) {
+      checksum ^= readByte(i);
+   }
+
+   if(checksum != readByte(5)) {
+      return false;
+   }
+
+   // Records are used as array indices and key positions
+   // without further checks
+   //
+   uint8_t n_inputs = readByte(3);
+   uint16_t offset = PPG_KLS_Storage_Header_Size;
+
+   for(uint8_t i = 0; i < n_inputs;
+       ++i, offset += PPG_KLS_Storage_Input_Record_Size) {
+
+      uint8_t input = readByte(offset);
+
+      if(   ((input != 0xFF) && (input >= numberOfInputs()))
+         || !validKeypos(readByte(offset + 1), readByte(offset + 2))) {
+         return false;
+      }
+   }
+
+   uint8_t n_actions = readByte(4);
+
+   for(uint8_t i = 0; i < n_actions;
+       ++i, offset += PPG_KLS_Storage_Action_Record_Size) {
+
+      uint8_t binding = readByte(offset);
+
+      if(   !validAction(binding >> 4, readWord(offset + 1))
+         || !validAction(binding & 0x0F, readWord(offset + 3))) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+// Makes sure that an upload is not applied before it is complete
+// and valid
+//
+static void beginUpload()
+{
+   valid_ = false;
+}
+
+static bool endUpload()
+{
+   valid_ = validate();
+   return valid_;
+}
+
+void begin()
+{
+   base_ = EEPROMSettings.requestSlice(PPG_KLS_STORAGE_SIZE);
+   valid_ = validate();
+}
+
+bool valid()
+{
+   return valid_;
+}
+
+PPG_Input_Id resolveInput(byte row, byte col, PPG_Input_Id compiled)
+{
+   if(!valid_) { return compiled; }
+
+   uint8_t n_inputs = readByte(3);
+   uint16_t offset = PPG_KLS_Storage_Header_Size;
+
+   for(uint8_t i = 0; i < n_inputs;
+       ++i, offset += PPG_KLS_Storage_Input_Record_Size) {
+
+      PPG_Input_Id input = readByte(offset);
+
+      if(   (readByte(offset + 1) == row)
+         && (readByte(offset + 2) == col)) {
+         
+         // Stored ids are single bytes, regardless of the width
+         // of PPG_Input_Id. Only the first 255 inputs can be rebound.
+         //
+         return (input == 0xFF) ? (PPG_Input_Id)PPG_KLS_Not_An_Input : input;
+      }
+
+      // The compiled input has been moved to another key position
+      //
+      if(input == compiled) {
+         compiled = PPG_KLS_Not_An_Input;
+      }
+   }
+
+   return compiled;
+}
+
+bool inputKeypos(PPG_Input_Id input, byte *row, byte *col)
+{
+   if(!valid_) { return false; }
+
+   uint8_t n_inputs = readByte(3);
+   uint16_t offset = PPG_KLS_Storage_Header_Size;
+
+   for(uint8_t i = 0; i < n_inputs;
+       ++i, offset += PPG_KLS_Storage_Input_Record_Size) {
+
+      if(readByte(offset) == input) {
+         *row = readByte(offset + 1);
+         *col = readByte(offset + 2);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+uint8_t resolveAction(uint8_t kind, uint16_t compiled, uint16_t *replacement)
+{
+   if(!valid_) { return 0; }
+
+   uint8_t n_actions = readByte(4);
+   uint16_t offset = actionRecordsOffset();
+
+   for(uint8_t i = 0; i < n_actions;
+       ++i, offset += PPG_KLS_Storage_Action_Record_Size) {
+
+      uint8_t binding = readByte(offset);
+
+      if(   ((binding >> 4) == kind)
+         && (readWord(offset + 1) == compiled)) {
+         *replacement = readWord(offset + 3);
+         return binding & 0x0F;
+      }
+   }
+
+   return 0;
+}
+
+bool focusHook(const char *command)
+{
+   if(strcmp_P(command, PSTR("papageno.bindings")) != 0) {
+      return false;
+   }
+
+   if(Serial.peek() == '\n') {
+      for(uint16_t i = 0; i < PPG_KLS_STORAGE_SIZE; ++i) {
+         Serial.print(readByte(i));
+         Serial.print(" ");
+      }
+      Serial.println();
+   }
+   else {
+
+      beginUpload();
+
+      for(uint16_t i = 0;
+          (i < PPG_KLS_STORAGE_SIZE) && (Serial.peek() != '\n');
+          ++i) {
+         EEPROM.update(base_ + i, (uint8_t)Serial.parseInt());
+      }
+
+      // An invalid blob is kept in EEPROM for inspection but ignored
+      //
+      if(!endUpload()) {
+         Serial.println(F("papageno.bindings: invalid"));
+      }
+   }
+
+   Serial.read();
+
+   return true;
+}
+
+} // namespace storage
+} // namespace papageno
+} // namespace kaleidoscope
+
+extern "C" {
+   
+   // Allows host test harnesses to upload a blob without Focus. Returns
+   // true if the blob is valid.
+   //
+   bool papageno_storage_upload(const uint8_t *blob, uint16_t size)
+   {
+      using namespace kaleidoscope::papageno::storage;
+      
+      beginUpload();
+      
+      for(uint16_t i = 0; (i < PPG_KLS_STORAGE_SIZE) && (i < size); ++i) {
+         EEPROM.update(base_ + i, blob[i]);
+      }
+      
+      return endUpload();
+   }
+}
+
+#endif
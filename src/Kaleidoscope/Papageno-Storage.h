@@ -0,0 +1,120 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Runtime bindings that are stored in EEPROM.
+//
+// The structure of the Papageno search tree is compiled into the firmware.
+// The inputs that feed the tree and the keycode/keypos actions that
+// it triggers can, however, be rebound at runtime. The bindings are stored
+// as a compact binary blob in an EEPROM slice and are interpreted in place,
+// i.e. nothing is copied to RAM apart from a validity flag.
+//
+// Blob layout (all offsets relative to the start of the blob,
+// multi-byte values little endian):
+//
+//    byte 0, 1   magic 'P', 'G'
+//    byte 2      format version (PPG_KLS_Storage_Version)
+//    byte 3      number of input records
+//    byte 4      number of action records
+//    byte 5      xor checksum of all record bytes
+//
+//    input records, 3 bytes each
+//       byte 0   input id (0xFF unbinds the key position)
+//       byte 1   new row
+//       byte 2   new col
+//
+//    action records, 5 bytes each
+//       byte 0   binding kind, high nibble: kind of the compiled action,
+//                low nibble: kind of the replacement
+//                (PPG_KLS_Binding_Keycode or PPG_KLS_Binding_Keypos)
+//       byte 1-2 compiled action (keycode raw or row << 8 | col)
+//       byte 3-4 replacement (keycode raw or row << 8 | col)
+//
+// Actions of type KEYCODE and COMPLEX_KEYCODE are both represented by their
+// raw keycode.
+//
+// Input ids must be smaller than the number of inputs of the sketch
+// and key positions must be inside the key matrix.
+//
+// The storage is only available if the plugin is compiled with
+// PPG_KLS_STORAGE_ENABLED defined. It requires the plugins
+// Kaleidoscope-EEPROM-Settings and Kaleidoscope-Focus.
+
+#ifdef PPG_KLS_STORAGE_ENABLED
+
+#include <Kaleidoscope/KPapageno.hpp>
+
+#ifndef PPG_KLS_STORAGE_SIZE
+#define PPG_KLS_STORAGE_SIZE 64
+#endif
+
+namespace kaleidoscope {
+namespace papageno {
+namespace storage {
+
+enum {
+   PPG_KLS_Storage_Version = 1,
+   PPG_KLS_Storage_Header_Size = 6,
+   PPG_KLS_Storage_Input_Record_Size = 3,
+   PPG_KLS_Storage_Action_Record_Size = 5
+};
+
+// Requests the EEPROM slice and validates its content. Must be called
+// before EEPROMSettings.seal().
+//
+void begin();
+
+// Returns true if a valid binding blob is present in EEPROM.
+//
+bool valid();
+
+// Resolves the input id for a key position. The compiled input
+// id is passed as argument and returned unless it is overridden.
+//
+PPG_Input_Id resolveInput(byte row, byte col, PPG_Input_Id compiled);
+
+// Determines the key position an input is currently bound to.
+// Returns false if the input was not rebound.
+//
+bool inputKeypos(PPG_Input_Id input, byte *row, byte *col);
+
+// Looks up a replacement for a compiled action. Returns the
+// kind of the replacement or zero if the action was not rebound.
+//
+uint8_t resolveAction(uint8_t kind, uint16_t compiled, uint16_t *replacement);
+
+// Focus hook "papageno.bindings". Without arguments the blob is dumped,
+// otherwise the bytes passed are written to EEPROM. A blob whose records
+// reference inputs, key positions or binding kinds that do not exist 
+// is rejected and the compiled bindings remain in effect.
+//
+// The plugin does not depend on Kaleidoscope-Focus and thus does not
+// register the hook itself. The sketch must do so, e.g.
+//
+//    Focus.addHook(FOCUS_HOOK(kaleidoscope::papageno::storage::focusHook,
+//                             "papageno.bindings"));
+//
+bool focusHook(const char *command);
+
+} // namespace storage
+} // namespace papageno
+} // namespace kaleidoscope
+
+#endif
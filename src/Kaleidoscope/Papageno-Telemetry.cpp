@@ -0,0 +1,104 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Note: We define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+//       here to suppress inclusion of the Papageno/Glockenspiel
+//       generated C/C++ code.
+//
+#define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+#include <Kaleidoscope/Papageno-Telemetry.h>
+
+#ifdef PPG_KLS_TELEMETRY_ENABLED
+
+namespace kaleidoscope {
+namespace papageno {
+namespace telemetry {
+
+uint16_t counters[PPG_KLS_N_Counters] = { 0 };
+
+uint8_t highWaterMarks[PPG_KLS_N_High_Water_Marks] = { 0 };
+
+PPG_KLS_Action_Counter *actionCounters = nullptr;
+
+void reset()
+{
+   for(uint8_t i = 0; i < PPG_KLS_N_Counters; ++i) {
+      counters[i] = 0;
+   }
+
+   for(uint8_t i = 0; i < PPG_KLS_N_High_Water_Marks; ++i) {
+      highWaterMarks[i] = 0;
+   }
+
+   for(PPG_Input_Id i = 0; i < numberOfInputs(); ++i) {
+      ppg_kls_input_counters[i].consumed = 0;
+      ppg_kls_input_counters[i].flushed = 0;
+   }
+
+   for(PPG_KLS_Action_Counter *c = actionCounters; c; c = c->next) {
+      c->count = 0;
+   }
+}
+
+bool focusHook(const char *command)
+{
+   if(strcmp_P(command, PSTR("papageno.stats.reset")) == 0) {
+      reset();
+   }
+   else if(strcmp_P(command, PSTR("papageno.stats")) == 0) {
+
+      for(uint8_t i = 0; i < PPG_KLS_N_Counters; ++i) {
+         Serial.print(counters[i]);
+         Serial.print(" ");
+      }
+      Serial.println();
+
+      for(PPG_Input_Id i = 0; i < numberOfInputs(); ++i) {
+         Serial.print(ppg_kls_input_counters[i].consumed);
+         Serial.print(" ");
+         Serial.print(ppg_kls_input_counters[i].flushed);
+         Serial.print(" ");
+      }
+      Serial.println();
+
+      for(uint8_t i = 0; i < PPG_KLS_N_High_Water_Marks; ++i) {
+         Serial.print(highWaterMarks[i]);
+         Serial.print(" ");
+      }
+      Serial.println();
+
+      for(PPG_KLS_Action_Counter *c = actionCounters; c; c = c->next) {
+         Serial.print(c->id);
+         Serial.print(" ");
+         Serial.print(c->count);
+         Serial.print(" ");
+      }
+      Serial.println();
+   }
+   else {
+      return false;
+   }
+
+   return true;
+}
+
+} // namespace telemetry
+} // namespace papageno
+} // namespace kaleidoscope
+
+#endif
@@ -0,0 +1,196 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Telemetry counters
+//
+// Counts signals emitted by the pattern matching engine and how often
+// the keystrokes of every input were consumed by a pattern or flushed
+// back to Kaleidoscope. Inputs that are mostly flushed belong to patterns
+// that typically time out or abort and thus only add latency.
+//
+// Every action of a pattern counts how often the pattern matched,
+// see countedAction below.
+//
+// Besides, the high-water marks of the matcher's resources (active
+// tokens, buffered events and the plugin's queues) are recorded as well
+// as how often any of them was exhausted. They help to size the queues
+// and PPG_KLS_MAX_BUFFERED_EVENTS for the patterns of a sketch.
+//
+// All counters are 16 bit and saturate instead of wrapping around.
+// The telemetry is only available if the plugin is compiled with
+// PPG_KLS_TELEMETRY_ENABLED defined.
+
+#ifdef PPG_KLS_TELEMETRY_ENABLED
+
+#include <Kaleidoscope/KPapageno.hpp>
+
+namespace kaleidoscope {
+namespace papageno {
+namespace telemetry {
+
+enum {
+   PPG_KLS_Count_Abort,
+   PPG_KLS_Count_Timeout,
+   PPG_KLS_Count_Match_Failed,
+   PPG_KLS_Count_Flush_Events,
+   PPG_KLS_Count_Action,
+   PPG_KLS_Count_Flushed_Events,
+   PPG_KLS_Count_Passthrough,
+   PPG_KLS_Count_Event_Limit,
+   PPG_KLS_Count_Ingestion_Queue_Full,
+   PPG_KLS_Count_Macro_Queue_Full,
+   PPG_KLS_N_Counters
+};
+
+enum {
+   PPG_KLS_High_Water_Active_Tokens,
+   PPG_KLS_High_Water_Buffered_Events,
+   PPG_KLS_High_Water_Ingestion_Queue,
+   PPG_KLS_High_Water_Macro_Queue,
+   PPG_KLS_N_High_Water_Marks
+};
+
+typedef struct {
+   uint16_t consumed;
+   uint16_t flushed;
+} PPG_KLS_Input_Counters;
+
+extern uint16_t counters[PPG_KLS_N_Counters];
+
+extern uint8_t highWaterMarks[PPG_KLS_N_High_Water_Marks];
+
+// The per input counters are initialized in Papageno-Initialization.h
+//
+extern PPG_KLS_Input_Counters ppg_kls_input_counters[];
+
+inline
+void increment(uint16_t &counter)
+{
+   if(counter != 0xFFFF) { ++counter; }
+}
+
+inline
+void count(uint8_t counter)
+{
+   increment(counters[counter]);
+}
+
+inline
+void countInput(PPG_Input_Id input, bool consumed)
+{
+   if(consumed) {
+      increment(ppg_kls_input_counters[input].consumed);
+   }
+   else {
+      increment(ppg_kls_input_counters[input].flushed);
+   }
+}
+
+inline
+void mark(uint8_t resource, uint8_t level)
+{
+   if(level > highWaterMarks[resource]) { highWaterMarks[resource] = level; }
+}
+
+// Counts the matches of the pattern that an action belongs to.
+// Actions register their counter when they first fire, so only 
+// actions that fired occupy RAM.
+//
+typedef struct PPG_KLS_Action_Counter_ {
+   uint16_t id;
+   uint16_t count;
+   struct PPG_KLS_Action_Counter_ *next;
+} PPG_KLS_Action_Counter;
+
+extern PPG_KLS_Action_Counter *actionCounters;
+
+inline
+void countAction(PPG_KLS_Action_Counter &counter, bool &registered)
+{
+   if(!registered) {
+      counter.next = actionCounters;
+      actionCounters = &counter;
+      registered = true;
+   }
+   
+   increment(counter.count);
+}
+
+// Wraps the callback of an action. Every action initializer of
+// the pattern tree instantiates it with its own id 
+// (see PPG_KLS_ACTION_CALLBACK in KPapageno.hpp). A match
+// is counted once, when the action is activated.
+//
+template<uint16_t Id__, PPG_Action_Callback_Fun Func__>
+void countedAction(PPG_Count activation_flags, void *user_data)
+{
+   static PPG_KLS_Action_Counter counter = { Id__, 0, nullptr };
+   static bool registered = false;
+   
+   if(   (activation_flags & PPG_Action_Activation_Flags_Active)
+      && !(activation_flags & PPG_Action_Activation_Flags_Repeated)) {
+      countAction(counter, registered);
+   }
+   
+   Func__(activation_flags, user_data);
+}
+
+void reset();
+
+// Focus hooks "papageno.stats" and "papageno.stats.reset".
+//
+// papageno.stats prints four lines. The first contains the global
+// counters in the order of the enum above, the second one pair
+// "consumed flushed" for every input id and the third the high-water
+// marks in the order of their enum. The fourth holds one pair
+// "action-id matches" for every action that fired.
+//
+bool focusHook(const char *command);
+
+} // namespace telemetry
+} // namespace papageno
+} // namespace kaleidoscope
+
+// The macros expand to a single statement and must be followed 
+// by a semicolon
+//
+#define PPG_KLS_COUNT(COUNTER)                                                 \
+   do {                                                                        \
+      kaleidoscope::papageno::telemetry::count(                                \
+         kaleidoscope::papageno::telemetry::PPG_KLS_Count_##COUNTER);          \
+   } while(0)
+
+#define PPG_KLS_COUNT_INPUT(INPUT, CONSUMED)                                   \
+   do {                                                                        \
+      kaleidoscope::papageno::telemetry::countInput(INPUT, CONSUMED);          \
+   } while(0)
+
+#define PPG_KLS_HIGH_WATER(RESOURCE, LEVEL)                                    \
+   do {                                                                        \
+      kaleidoscope::papageno::telemetry::mark(                                 \
+         kaleidoscope::papageno::telemetry::PPG_KLS_High_Water_##RESOURCE,     \
+         LEVEL);                                                               \
+   } while(0)
+
+#else
+#define PPG_KLS_COUNT(COUNTER) do {} while(0)
+#define PPG_KLS_COUNT_INPUT(INPUT, CONSUMED) do {} while(0)
+#define PPG_KLS_HIGH_WATER(RESOURCE, LEVEL) do {} while(0)
+#endif
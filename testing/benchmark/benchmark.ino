@@ -0,0 +1,463 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// A benchmark sketch for the atmega32u4 that is meant to be run
+// by a cycle accurate simulator (simavr), see tools/papageno-benchmark.py.
+//
+// Attention: The benchmark has not yet been run under simavr. 
+// Its results are unverified.
+//
+// A script of key events is fed to Kaleidoscope's event handler.
+// For every event, the CPU cycles of the event handler and of the
+// subsequent call to Papageno.loop() are measured with Timer1. The cost
+// of an idle loop is subtracted. The cycles are accumulated per category
+// of the event's path through the plugin (passthrough, consumed,
+// flushed, matched). Finally, the maximum stack usage is determined
+// from a stack that was painted at startup.
+//
+// The category of a step is determined from what the plugin
+// actually did, not from the script. Steps that caused an action are
+// matched, steps that flushed events to Kaleidoscope are flushed.
+// Otherwise, a key event that reached the event handler hook that 
+// is registered after the plugin's was passed through, any other 
+// key event was consumed. The plugin's telemetry counters tell about 
+// actions and flushed events. The sketch must therefore be built with 
+// PPG_KLS_TELEMETRY_ENABLED (CMake option KALEIDOSCOPE_PAPAGENO_TELEMETRY). 
+// The counting adds a few cycles to every category.
+//
+// The results are written to USART1, one line per category,
+//
+//    papageno.benchmark <category> <count> <min> <mean> <max>
+//
+// followed by
+//
+//    papageno.benchmark stack <bytes>
+//    papageno.benchmark end
+//
+// The measured cycles include the Timer0 interrupt that drives millis(),
+// just as on the device. As the key scanners are not simulated,
+// the matrix scan of Papageno.loop() finds no keys.
+
+#include "Kaleidoscope.h"
+
+#include <kaleidoscope/hid.h>
+
+#define KALEIDOSCOPE_PAPAGENO_HAVE_USER_FUNCTIONS
+#include "Kaleidoscope-Papageno.h"
+
+#ifndef PPG_KLS_TELEMETRY_ENABLED
+#error "The benchmark requires PPG_KLS_TELEMETRY_ENABLED"
+#endif
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <stdlib.h>
+
+const Key keymaps[][ROWS][COLS] PROGMEM = {
+  [0] = KEYMAP_STACKED
+  (
+    Key_NoKey,    Key_1, Key_2, Key_3, Key_4, Key_5, Key_NoKey,
+    Key_Backtick, Key_Q, Key_W, Key_E, Key_R, Key_T, Key_Tab,
+    Key_PageUp,   Key_A, Key_S, Key_D, Key_F, Key_G,
+    Key_PageDown, Key_Z, Key_X, Key_C, Key_V, Key_B, Key_Escape,
+
+    Key_LeftControl, Key_Backspace, Key_LeftGui, Key_LeftShift,
+    Key_NoKey,
+
+    Key_NoKey, Key_6, Key_7, Key_8,     Key_9,      Key_0,         Key_NoKey,
+    Key_Enter, Key_Y, Key_U, Key_I,     Key_O,      Key_P,         Key_Equals,
+               Key_H, Key_J, Key_K,     Key_L,      Key_Semicolon, Key_Quote,
+    Key_NoKey, Key_N, Key_M, Key_Comma, Key_Period, Key_Slash,     Key_Minus,
+
+    Key_RightShift, Key_RightAlt, Key_Spacebar, Key_RightControl,
+    Key_NoKey),
+};
+
+/*
+glockenspiel_begin
+
+default: event_timeout = $ 200 $
+
+input: LeftThumb <KEYPOS> = $ 1, 7 $
+input: RightThumb <KEYPOS> = $ 1, 8 $
+
+|LeftThumb| -> |RightThumb| : Key_Tab
+|LeftThumb|*2 : Key_Escape
+
+glockenspiel_end
+*/
+
+namespace {
+
+enum { Press, Release, Wait };
+
+enum {
+   Passthrough,
+   Consumed,
+   Flushed,
+   Matched,
+   N_Categories,
+   Uncounted = 0xFF
+};
+
+const char passthroughName[] PROGMEM = "passthrough";
+const char consumedName[] PROGMEM = "consumed";
+const char flushedName[] PROGMEM = "flushed";
+const char matchedName[] PROGMEM = "matched";
+
+const char * const categoryNames[N_Categories] PROGMEM = {
+   passthroughName, consumedName, flushedName, matchedName
+};
+
+typedef struct {
+   uint8_t op;
+   uint8_t row;
+   uint8_t col;
+   uint16_t ms;      // only Wait
+} Step;
+
+// KEYPOS is a row, column pair
+//
+#define PRESS(KEYPOS)   { Press, KEYPOS, 0 }
+#define RELEASE(KEYPOS) { Release, KEYPOS, 0 }
+#define WAIT(MS)        { Wait, 0, 0, MS }
+
+#define NON_INPUT 3, 2     // Key_X
+#define LEFT_THUMB 1, 7
+#define RIGHT_THUMB 1, 8
+
+// A wait that exceeds the event timeout separates the
+// groups of events.
+//
+const Step script[] PROGMEM = {
+
+   // A key that is not an input
+   //
+   PRESS(NON_INPUT),
+   RELEASE(NON_INPUT),
+
+   // A note line
+   //
+   PRESS(LEFT_THUMB),
+   RELEASE(LEFT_THUMB),
+   PRESS(RIGHT_THUMB),
+   RELEASE(RIGHT_THUMB),
+   WAIT(300),
+
+   // A tap dance
+   //
+   PRESS(LEFT_THUMB),
+   RELEASE(LEFT_THUMB),
+   PRESS(LEFT_THUMB),
+   RELEASE(LEFT_THUMB),
+   WAIT(300),
+
+   // Pattern matching aborted by a key that is not an input
+   //
+   PRESS(LEFT_THUMB),
+   PRESS(NON_INPUT),
+   RELEASE(NON_INPUT),
+   RELEASE(LEFT_THUMB),
+   WAIT(300),
+
+   // Pattern matching that times out
+   //
+   PRESS(LEFT_THUMB),
+   RELEASE(LEFT_THUMB),
+   WAIT(300)
+};
+
+const uint8_t nRounds = 16;
+
+typedef struct {
+   uint16_t count;
+   uint32_t min;
+   uint32_t max;
+   uint32_t sum;
+} Statistics;
+
+Statistics statistics[N_Categories];
+
+uint32_t timerOverhead = 0;
+uint32_t idleLoopCycles = 0;
+
+// The key position of the current step and whether a key event
+// at this position was passed on by the plugin
+//
+uint8_t stepRow = 0xFF;
+uint8_t stepCol = 0xFF;
+bool passedOn = false;
+
+// Registered after the plugin's event handler hook. Kaleidoscope
+// only calls it for events that the plugin did not consume.
+//
+Key observePassthrough(Key mapped_key, byte row, byte col, uint8_t key_state)
+{
+   if((row == stepRow) && (col == stepCol)) {
+      passedOn = true;
+   }
+   
+   return mapped_key;
+}
+
+uint16_t counter(uint8_t id)
+{
+   return kaleidoscope::papageno::telemetry::counters[id];
+}
+
+// Timer1 runs at the CPU clock. Its overflows extend the count to
+// 32 bit.
+//
+volatile uint16_t timer1Overflows = 0;
+
+uint32_t cycles()
+{
+   uint8_t sreg = SREG;
+   cli();
+
+   uint16_t low = TCNT1;
+   uint16_t high = timer1Overflows;
+
+   // An overflow that is not yet serviced
+   //
+   if((TIFR1 & _BV(TOV1)) && (low < 0x8000)) {
+      ++high;
+   }
+
+   SREG = sreg;
+
+   return ((uint32_t)high << 16) | low;
+}
+
+void startCycleCounter()
+{
+   TCCR1A = 0;
+   TCCR1B = _BV(CS10);
+   TCNT1 = 0;
+   TIMSK1 = _BV(TOIE1);
+
+   uint32_t start = cycles();
+   timerOverhead = cycles() - start;
+}
+
+uint32_t measuredLoop()
+{
+   uint32_t start = cycles();
+   Papageno.loop();
+   return cycles() - start - timerOverhead;
+}
+
+void record(uint8_t category, uint32_t cycles)
+{
+   if(category == Uncounted) { return; }
+
+   Statistics &s = statistics[category];
+
+   if((s.count == 0) || (cycles < s.min)) { s.min = cycles; }
+   if(cycles > s.max) { s.max = cycles; }
+   s.sum += cycles;
+   ++s.count;
+}
+
+void runStep(const Step *step_P)
+{
+   using namespace kaleidoscope::papageno::telemetry;
+   
+   Step step;
+   memcpy_P(&step, step_P, sizeof(Step));
+
+   uint32_t used = 0;
+   
+   uint16_t actions = counter(PPG_KLS_Count_Action);
+   uint16_t flushed = counter(PPG_KLS_Count_Flushed_Events);
+   
+   stepRow = (step.op == Wait) ? 0xFF : step.row;
+   stepCol = (step.op == Wait) ? 0xFF : step.col;
+   passedOn = false;
+
+   if(step.op == Wait) {
+      delay(step.ms);
+   }
+   else {
+      uint32_t start = cycles();
+      handleKeyswitchEvent(Key_NoKey, step.row, step.col,
+                           (step.op == Press) ? IS_PRESSED : WAS_PRESSED);
+      used = cycles() - start - timerOverhead;
+   }
+
+   // In deferred matching mode and on timeouts, the work is done
+   // by the loop.
+   //
+   uint32_t loop = measuredLoop();
+
+   if(loop > idleLoopCycles) {
+      used += loop - idleLoopCycles;
+   }
+   
+   uint8_t category = Uncounted;
+   
+   if(counter(PPG_KLS_Count_Action) != actions) {
+      category = Matched;
+   }
+   else if(counter(PPG_KLS_Count_Flushed_Events) != flushed) {
+      category = Flushed;
+   }
+   else if(passedOn) {
+      category = Passthrough;
+   }
+   else if(step.op != Wait) {
+      category = Consumed;
+   }
+
+   record(category, used);
+}
+
+// Paint the stack before main() is entered
+//
+extern "C" {
+extern uint8_t _end;
+extern uint8_t __stack;
+}
+
+const uint8_t stackPaint = 0xC5;
+
+void paintStack() __attribute__((naked, used, section(".init3")));
+
+void paintStack()
+{
+   for(uint8_t *p = &_end; p <= &__stack; ++p) {
+      *p = stackPaint;
+   }
+}
+
+uint16_t stackHighWater()
+{
+   const uint8_t *p = &_end;
+
+   while((p <= &__stack) && (*p == stackPaint)) {
+      ++p;
+   }
+
+   return &__stack - p + 1;
+}
+
+// Output to USART1 without interrupts. The simulator prints
+// the transmitted characters.
+//
+void put(char c)
+{
+   while(!(UCSR1A & _BV(UDRE1))) {}
+   UDR1 = c;
+}
+
+void print(const char *s)
+{
+   while(*s) { put(*s++); }
+}
+
+void print_P(const char *s_P)
+{
+   char c;
+   while((c = pgm_read_byte(s_P++))) { put(c); }
+}
+
+void print(uint32_t value)
+{
+   char buffer[11];
+   ultoa(value, buffer, 10);
+   put(' ');
+   print(buffer);
+}
+
+void report()
+{
+   UBRR1 = 8;        // 115200 baud at 16 MHz
+   UCSR1B = _BV(TXEN1);
+
+   for(uint8_t i = 0; i < N_Categories; ++i) {
+
+      const Statistics &s = statistics[i];
+
+      print("papageno.benchmark ");
+      print_P((const char *)pgm_read_ptr(&categoryNames[i]));
+      print((uint32_t)s.count);
+      print(s.min);
+      print((s.count) ? (s.sum / s.count) : 0);
+      print(s.max);
+      put('\n');
+   }
+
+   print("papageno.benchmark stack");
+   print((uint32_t)stackHighWater());
+   put('\n');
+   print("papageno.benchmark end\n");
+
+   delay(10);
+}
+
+} // namespace
+
+ISR(TIMER1_OVF_vect)
+{
+   ++timer1Overflows;
+}
+
+void setup() {
+
+  Kaleidoscope.use(&Papageno);
+  
+  // Must follow the plugin's hook
+  //
+  Kaleidoscope.useEventHandlerHook(observePassthrough);
+
+  Kaleidoscope.setup();
+
+  startCycleCounter();
+}
+
+void loop() {
+
+   // The cost of a loop without events
+   //
+   idleLoopCycles = 0xFFFFFFFF;
+
+   for(uint8_t i = 0; i < 16; ++i) {
+      uint32_t loop = measuredLoop();
+      if(loop < idleLoopCycles) { idleLoopCycles = loop; }
+   }
+
+   kaleidoscope::papageno::telemetry::reset();
+
+   for(uint8_t round = 0; round < nRounds; ++round) {
+      for(uint8_t i = 0; i < sizeof(script)/sizeof(Step); ++i) {
+         runStep(&script[i]);
+      }
+   }
+
+   report();
+
+   // Stops the simulator
+   //
+   cli();
+   sleep_enable();
+   sleep_cpu();
+}
+
+extern "C" {
+#include "Kaleidoscope-Papageno-Sketch.hpp"
+}
@@ -17,9 +17,78 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import ctypes
+import sys
+
 import leidokos
 from leidokos import *
 
+def findFirmwareSymbol(name):
+   
+   # Optional features of the plugin export C symbols from the 
+   # firmware module, e.g. papageno_advance_time if the firmware was built 
+   # with KALEIDOSCOPE_PAPAGENO_VIRTUAL_CLOCK.
+   #
+   for module in list(sys.modules.values()):
+      
+      path = getattr(module, "__file__", None)
+      
+      if not path or not path.endswith(".so"):
+         continue
+      
+      try:
+         return getattr(ctypes.CDLL(path), name)
+      except (OSError, AttributeError):
+         pass
+      
+   return None
+
+def findVirtualClock():
+   return findFirmwareSymbol("papageno_advance_time")
+
+def findStorageUpload():
+   
+   # Exported if the firmware was built with KALEIDOSCOPE_PAPAGENO_STORAGE
+   #
+   upload = findFirmwareSymbol("papageno_storage_upload")
+   
+   if upload:
+      upload.argtypes = [ctypes.c_char_p, ctypes.c_uint16]
+      upload.restype = ctypes.c_bool
+      
+   return upload
+
+def findSetProfile():
+   
+   # Exported by the test sketch
+   #
+   setProfile = findFirmwareSymbol("papageno_test_set_profile")
+   
+   if setProfile:
+      setProfile.argtypes = [ctypes.c_uint8]
+      
+   return setProfile
+
+def bindingsBlob(inputs, actions):
+   
+   # See src/Kaleidoscope/Papageno-Storage.h for the format
+   #
+   records = []
+   
+   for input_id, row, col in inputs:
+      records += [input_id, row, col]
+      
+   for binding, compiled, replacement in actions:
+      records += [binding, compiled & 0xFF, compiled >> 8,
+                  replacement & 0xFF, replacement >> 8]
+      
+   checksum = 0
+   for byte in records:
+      checksum ^= byte
+      
+   return bytes([ord('P'), ord('G'), 1, len(inputs), len(actions), checksum] 
+                + records)
+
 class NoseglassesTest(TestDriver):
    
    def keyDownWait(self, key_name):
@@ -49,6 +118,27 @@ class NoseglassesTest(TestDriver):
       self.keyDownWait(key)
       self.keyUpWait(key)
       
+   def skip(self, description, reason):
+      
+      # Tests of optional features are reported as skipped if the
+      # firmware was built without the feature
+      #
+      self.header(description)
+      self.log("SKIPPED: %s" % reason)
+      
+   def advanceTime(self, delta):
+      
+      # With the virtual clock, time is advanced instantly and a single
+      # scan cycle is sufficient to process timeouts. Otherwise,
+      # we have to wait for real time to pass.
+      #
+      if self.virtualClock:
+         self.log("Advancing virtual clock by %d ms" % delta)
+         self.virtualClock(ctypes.c_uint16(delta))
+         self.scanCycle()
+      else:
+         self.skipTime(delta)
+      
    def run(self):
       
       self.description(
@@ -83,11 +173,24 @@ class NoseglassesTest(TestDriver):
       self.ng_Key_Z = (3,  1)
       self.ng_Key_H = (2,  14)
       self.ng_Key_W = (1,  2)
+      self.ng_Key_T = (2,  4)
+      self.ng_Key_G = (2,  5)
+      
+      self.ng_Prog_Key = (0,  0)
+      
+      # Keys that are mapped to keycode inputs
+      #
+      self.ng_Key_B = (3,  5)
+      self.ng_Ctrl_X = (0,  5)
             
       self.ng_Key_Quote = (3, 13)
             
       self.errorIfReportWithoutQueuedAssertions = True
       
+      self.virtualClock = findVirtualClock()
+      self.storageUpload = findStorageUpload()
+      self.setProfile = findSetProfile()
+      
       self.addPermanentReportAssertions([ 
          DumpReport()
       ])
@@ -224,7 +327,7 @@ class NoseglassesTest(TestDriver):
       ])
       self.keyTap("special3")
       self.keyTap("special3")
-      self.skipTime(500) # Enable timeout
+      self.advanceTime(500) # Enable timeout
       self.checkStatus()
       
    def test8(self):
@@ -523,7 +626,7 @@ class NoseglassesTest(TestDriver):
       self.keyTap("ng_Key_S")
       self.keyDown(*self.ng_Key_S)
       
-      self.skipTime(500)
+      self.advanceTime(500)
       self.checkStatus()
       
       self.queueGroupedReportAssertions([
@@ -582,7 +685,7 @@ class NoseglassesTest(TestDriver):
       
       self.keyTap("ng_Key_I")
       
-      self.skipTime(500)
+      self.advanceTime(500)
       self.checkStatus()
       
    def test23(self):
@@ -679,9 +782,9 @@ class NoseglassesTest(TestDriver):
       #self.skipTime(500)
       self.keyDownWait("ng_Key_E")
       self.keyUpWait("ng_Key_S")
-      self.skipTime(500)
+      self.advanceTime(500)
       self.keyUpWait("ng_Key_E")
-      self.skipTime(500)
+      self.advanceTime(500)
       self.checkStatus()
          
    def test27(self):
@@ -737,9 +840,9 @@ class NoseglassesTest(TestDriver):
       #self.skipTime(500)
       self.keyDownWait("ng_Key_A")
       self.keyUpWait("ng_Key_E")
-      self.skipTime(500)
+      self.advanceTime(500)
       self.keyUpWait("ng_Key_A")
-      self.skipTime(500)
+      self.advanceTime(500)
       self.checkStatus()
       
    def test29(self):
@@ -766,7 +869,7 @@ class NoseglassesTest(TestDriver):
       self.keyTap("ng_Key_S")
       self.keyTap("ng_Key_S")
       
-      self.skipTime(500)
+      self.advanceTime(500)
       self.checkStatus()
       
    def test30(self):
@@ -833,6 +936,392 @@ class NoseglassesTest(TestDriver):
       self.keyUpWait("ng_Key_H")
       self.checkStatus()
       
+   def test32(self):
+      
+      if not self.storageUpload:
+         self.skip("Bindings with records out of range are rejected",
+                   "the firmware was built without KALEIDOSCOPE_PAPAGENO_STORAGE")
+         return
+      
+      self.header("Bindings with records out of range are rejected")
+      
+      binding_keycode = 1
+      binding_keypos = 2
+      
+      invalid = [
+         ("an input id that does not exist", 
+            bindingsBlob([(0xFE, 2, 7)], [])),
+         ("an input at a row outside the matrix", 
+            bindingsBlob([(0, 0xF0, 7)], [])),
+         ("an input at an unknown key position", 
+            bindingsBlob([(0, 0xFF, 0xFF)], [])),
+         ("a keypos action outside the matrix", 
+            bindingsBlob([], [((binding_keycode << 4) | binding_keypos, 
+                               0x0028, 0xF007)])),
+         ("an unknown binding kind", 
+            bindingsBlob([], [((binding_keycode << 4) | 0x07, 
+                               0x0028, 0x002B)]))
+      ]
+      
+      for description, blob in invalid:
+         self.log("Uploading %s" % description)
+         if self.storageUpload(blob, len(blob)):
+            raise AssertionError("Bindings with %s were accepted" % description)
+      
+      # The compiled bindings remain in effect
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyEnter()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("leftThumb3")
+      self.keyTap("rightThumb2")
+      self.checkStatus()
+      
+   def test33(self):
+      
+      self.header("A cluster whose keys are pressed in the same scan cycle")
+      
+      # In deferred matching mode (KALEIDOSCOPE_PAPAGENO_DEFERRED_MATCHING), 
+      # both key events are queued during the same matrix scan and 
+      # matched afterwards by Papageno.loop(). They must be matched in
+      # the order they were scanned, just as without deferral.
+      #
+      # {LeftThumb3, RightThumb2} : Key_Enter
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyEnter()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyDown(*self.leftThumb3)
+      self.keyDown(*self.rightThumb2)
+      self.scanCycle()
+      self.scanCycle()
+      self.scanCycle()
+      self.keyUp(*self.leftThumb3)
+      self.keyUp(*self.rightThumb2)
+      self.scanCycle()
+      self.scanCycle()
+      self.scanCycle()
+      self.checkStatus()
+      
+   def test34(self):
+      
+      self.header("A macro is played back one key event per scan cycle")
+      #
+      # |Special2|*2 : saveAndClose
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyS()], exclusively = True),
+         ReportModifiersActive([keyLCtrl()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyW()], exclusively = True),
+         ReportModifiersActive([keyLCtrl()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("special2")
+      self.keyTap("special2")
+      self.scanCycle()
+      self.scanCycle()
+      self.scanCycle()
+      self.scanCycle()
+      self.checkStatus()
+      
+   def test35(self):
+      
+      if not self.storageUpload:
+         self.skip("Rebound inputs and actions take effect",
+                   "the firmware was built without KALEIDOSCOPE_PAPAGENO_STORAGE")
+         return
+      
+      self.header("Rebound inputs and actions take effect")
+      
+      binding_keycode = 1
+      left_thumb3_id = 2
+      
+      # LeftThumb3 is moved to the key position of Key_X and the 
+      # Key_Enter action of the cluster is replaced by Key_Tab.
+      #
+      # {LeftThumb3, RightThumb2} : Key_Enter
+      #
+      blob = bindingsBlob([(left_thumb3_id, self.ng_Key_X[0], self.ng_Key_X[1])], 
+                          [((binding_keycode << 4) | binding_keycode, 
+                            0x0028, 0x002B)])
+      
+      if not self.storageUpload(blob, len(blob)):
+         raise AssertionError("Valid bindings were rejected")
+      
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyTab()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("ng_Key_X")
+      self.keyTap("rightThumb2")
+      self.checkStatus()
+      
+      # The compiled bindings are restored by an empty blob
+      #
+      blob = bindingsBlob([], [])
+      
+      if not self.storageUpload(blob, len(blob)):
+         raise AssertionError("Empty bindings were rejected")
+      
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyEnter()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("leftThumb3")
+      self.keyTap("rightThumb2")
+      self.checkStatus()
+      
+   def switchProfile(self, profile):
+      
+      # Profile changes are applied at the beginning of the next
+      # scan cycle
+      #
+      self.log("Switching to profile %d" % profile)
+      self.setProfile(profile)
+      self.scanCycle()
+      
+   def test36(self):
+      
+      if not self.setProfile:
+         self.skip("A profile without patterns passes keys through",
+                   "the firmware does not export papageno_test_set_profile")
+         return
+      
+      self.header("A profile without patterns passes keys through")
+      
+      # Profile 1 is registered with a NULL context. 
+      # |NG_Key_E|*3 : umlaut_A must not be matched.
+      #
+      for i in range(3):
+         self.queueGroupedReportAssertions([
+            ReportKeysActive([keyE()], exclusively = True),
+            ReportAllModifiersInactive()
+         ])
+         self.queueGroupedReportAssertions([
+            ReportEmpty()
+         ])
+         
+      self.switchProfile(1)
+      self.keyTap("ng_Key_E")
+      self.keyTap("ng_Key_E")
+      self.keyTap("ng_Key_E")
+      self.checkStatus()
+      
+      self.switchProfile(0)
+      
+   def test37(self):
+      
+      if not self.setProfile:
+         self.skip("A profile switch flushes a pending match",
+                   "the firmware does not export papageno_test_set_profile")
+         return
+      
+      self.header("A profile switch flushes a pending match")
+      
+      # The first tap of |NG_Key_E|*3 : umlaut_A is held back by 
+      # Papageno. Switching the profile aborts pattern matching 
+      # and passes it on to Kaleidoscope before any timeout.
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyE()], exclusively = True),
+         ReportAllModifiersInactive()
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      
+      self.keyTap("ng_Key_E")
+      self.switchProfile(1)
+      self.checkStatus()
+      
+      self.switchProfile(0)
+      
+   def armSequences(self):
+      
+      # |NG_Prog_Key|*2 : lead arms the automaton of test_sequences.txt
+      #
+      self.keyTap("ng_Prog_Key")
+      self.keyTap("ng_Prog_Key")
+      
+   def test38(self):
+      
+      self.header("Leader sequence \"git\" after arming")
+      
+      # The keys of the sequence are consumed, only the action
+      # is reported
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF6()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.armSequences()
+      self.keyTap("ng_Key_G")
+      self.keyTap("ng_Key_I")
+      self.keyTap("ng_Key_T")
+      self.checkStatus()
+      
+   def test39(self):
+      
+      self.header("Leader sequence \"gi\", a prefix of \"git\", followed by space")
+      
+      # The space does not continue "git". It completes "gi"
+      # and is then processed as usual.
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF5()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keySpace()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.armSequences()
+      self.keyTap("ng_Key_G")
+      self.keyTap("ng_Key_I")
+      self.keyTap("rightThumb3")
+      self.checkStatus()
+      
+   def test40(self):
+      
+      self.header("Leader sequence reached via a failure link")
+      
+      # "eas" is not continued by "a". The automaton falls back 
+      # to "s", the prefix of "sat", instead of starting over.
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF8()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.armSequences()
+      self.keyTap("ng_Key_E")
+      self.keyTap("ng_Key_A")
+      self.keyTap("ng_Key_S")
+      self.keyTap("ng_Key_A")
+      self.keyTap("ng_Key_T")
+      self.checkStatus()
+      
+   def test41(self):
+      
+      self.header("Leader sequence \"gi\" completed by the timeout")
+      
+      # sequences::checkTimeout triggers the action of "gi" and 
+      # disarms the automaton. The timeout of test_sequences.txt 
+      # is 500 ms.
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF5()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.armSequences()
+      self.keyTap("ng_Key_G")
+      self.keyTap("ng_Key_I")
+      self.advanceTime(600)
+      self.checkStatus()
+      
+      # Keys are no longer consumed
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyG()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("ng_Key_G")
+      self.checkStatus()
+      
+   def test42(self):
+      
+      self.header("Keycode input Key_B")
+      #
+      # |Key_B|*2 : Key_F10
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF10()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("ng_Key_B")
+      self.keyTap("ng_Key_B")
+      self.checkStatus()
+      
+   def test43(self):
+      
+      self.header("Complex keycode input ctrl_X")
+      #
+      # |ctrl_X|*2 : Key_F11
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyF11()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("ng_Ctrl_X")
+      self.keyTap("ng_Ctrl_X")
+      self.checkStatus()
+      
+   def test44(self):
+      
+      self.header("A held keycode input is flushed and released at its key position")
+      
+      # The press is flushed by the timeout while the key is held. 
+      # The release is passed on when the key is released.
+      #
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyB()], exclusively = True),
+         ReportAllModifiersInactive()
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyDownWait("ng_Key_B")
+      self.advanceTime(500)
+      self.keyUpWait("ng_Key_B")
+      self.checkStatus()
+      
+   def test45(self):
+      
+      self.header("A tapped complex keycode input is flushed with its modifiers")
+      
+      self.queueGroupedReportAssertions([
+         ReportKeysActive([keyX()], exclusively = True),
+         ReportModifiersActive([keyLCtrl()], exclusively = True)
+      ])
+      self.queueGroupedReportAssertions([
+         ReportEmpty()
+      ])
+      self.keyTap("ng_Ctrl_X")
+      self.advanceTime(500)
+      self.checkStatus()
+      
    def runTestSeries(self):
       
       self.test1()
@@ -870,6 +1359,21 @@ class NoseglassesTest(TestDriver):
       # https://github.com/keyboardio/Kaleidoscope-OneShot/issues/26#issuecomment-385872421
       #self.test31()
       
+      self.test32()
+      self.test35()
+      self.test33()
+      self.test34()
+      self.test36()
+      self.test37()
+      self.test38()
+      self.test39()
+      self.test40()
+      self.test41()
+      self.test42()
+      self.test43()
+      self.test44()
+      self.test45()
+      
 def main():
     
    test = NoseglassesTest()
@@ -17,6 +17,10 @@
 
 #include "Kaleidoscope-OneShot.h"
 
+// Leader sequences, generated from test_sequences.txt
+//
+#include "test_sequences.h"
+
 enum { NORMAN, M1, M2, M3 }; // layers
 
 const Key keymaps[][ROWS][COLS] PROGMEM = {
@@ -100,6 +104,20 @@ void setup() {
 
       &OneShot
   ); 
+  
+  // Profile 1: no patterns
+  //
+  Papageno.addProfile(NULL);
+}
+
+extern "C" {
+   
+   // Allows the test driver to switch profiles
+   //
+   void papageno_test_set_profile(uint8_t profile)
+   {
+      Papageno.setProfile(profile);
+   }
 }
 
 void loop() {
@@ -148,6 +166,11 @@ input: NG_Key_S <KEYPOS> = $ 2,  2 $
 
 input: NG_Prog_Key <KEYPOS> = $ 0,  0 $
 
+% Keycode inputs are caused by any key that is mapped to the keycode
+%
+input: Key_B <KEYCODE>
+input: ctrl_X <COMPLEX_KEYCODE> = $ LCTRL(Key_X) $
+
 %alias: a = RightThumb1
 %alias: b = RightThumb2
 %alias: c = RightThumb3
@@ -165,6 +188,8 @@ action: repeatLastCommand <USER_FUNCTION> =  $ repeatLastCommandCB, NULL $
 action: ordinarySearch <USER_FUNCTION> =  $ ordinarySearchCB, NULL $ 
 action: fileSearch <USER_FUNCTION> =  $ fileSearchCB, NULL $ 
 
+action: saveAndClose <MACRO> =  $ saveAndCloseSequence $ 
+
 action: umlaut_A <USER_FUNCTION> =  $ umlautCB, (void*)Key_A.raw $ 
 action: umlaut_O <USER_FUNCTION> =  $ umlautCB, (void*)Key_O.raw $ 
 action: umlaut_U <USER_FUNCTION> =  $ umlautCB, (void*)Key_U.raw $ 
@@ -174,6 +199,8 @@ action: umlaut_S <COMPLEX_KEYCODE> =  $ RALT(Key_S) $
 
 action: reboot <USER_FUNCTION> =  $ rebootCB, NULL $ 
 
+action: lead <USER_FUNCTION> = $ kaleidoscope::papageno::Papageno::leadSequences, (void*)&test_sequences $
+
 %###############################################################################
 % Patterns
 %###############################################################################
@@ -215,8 +242,21 @@ action: reboot <USER_FUNCTION> =  $ rebootCB, NULL $
 
 |Special6|*2 : shiftCtrlC
 
+% A macro that is played back by Papageno.loop()
+%
+|Special2|*2 : saveAndClose
+
 %|NG_Prog_Key|*5 : toggleLEDEffect@2, reboot@5
 
+% Arms the leader sequences of test_sequences.txt
+%
+|NG_Prog_Key|*2 : lead
+
+% Tap dances on keycode inputs
+%
+|Key_B|*2 : Key_F10
+|ctrl_X|*2 : Key_F11
+
 % Assign german umlauts as tripple taps to
 % suitable and non-colliding (digraphs!) keys of the home row
 %
@@ -325,6 +365,10 @@ void fileSearchCB(PPG_Count activation_flags, void *user_data)
    tapKey(Key_Enter);
 }
 
+// Saves and closes the current document
+//
+PPG_KLS_MACRO(saveAndCloseSequence, LCTRL(Key_S), LCTRL(Key_W))
+
 void umlautCB(PPG_Count activation_flags, void *user_data)
 {
 //    PPG_CALLBACK_NO_REPEAT
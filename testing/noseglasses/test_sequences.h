@@ -0,0 +1,39 @@
+// Generated by tools/papageno-sequences.py, do not edit
+
+static const kaleidoscope::papageno::PPG_KLS_Sequence_Edge test_sequences_edges[] PROGMEM = {
+   { Key_G, 1 },
+   { Key_E, 4 },
+   { Key_S, 8 },
+   { Key_I, 2 },
+   { Key_T, 3 },
+   { Key_A, 5 },
+   { Key_S, 6 },
+   { Key_E, 7 },
+   { Key_A, 9 },
+   { Key_T, 10 },
+};
+
+static const kaleidoscope::papageno::PPG_KLS_Sequence_State test_sequences_states[] PROGMEM = {
+   { 0, 0, 3, 0 },
+   { 0, 3, 1, 0 },
+   { 0, 4, 1, 1 },
+   { 0, 5, 0, 2 },
+   { 0, 5, 1, 0 },
+   { 0, 6, 1, 0 },
+   { 8, 7, 1, 0 },
+   { 4, 8, 0, 3 },
+   { 0, 8, 1, 0 },
+   { 0, 9, 1, 0 },
+   { 0, 10, 0, 4 },
+};
+
+static const kaleidoscope::papageno::PPG_KLS_Sequence_Action test_sequences_actions[] PROGMEM = {
+   { (PPG_Action_Callback_Fun)kaleidoscope::papageno::Papageno::processKeycode, (void*)(uintptr_t)(Key_F5.raw) }, // Key_G Key_I
+   { (PPG_Action_Callback_Fun)kaleidoscope::papageno::Papageno::processKeycode, (void*)(uintptr_t)(Key_F6.raw) }, // Key_G Key_I Key_T
+   { (PPG_Action_Callback_Fun)kaleidoscope::papageno::Papageno::processKeycode, (void*)(uintptr_t)(Key_F7.raw) }, // Key_E Key_A Key_S Key_E
+   { (PPG_Action_Callback_Fun)kaleidoscope::papageno::Papageno::processKeycode, (void*)(uintptr_t)(Key_F8.raw) }, // Key_S Key_A Key_T
+};
+
+static const kaleidoscope::papageno::PPG_KLS_Sequence_Automaton test_sequences PROGMEM = {
+   test_sequences_states, test_sequences_edges, test_sequences_actions, 500
+};
@@ -0,0 +1,17 @@
+// The input lists of sketch.ino in the form that Papageno-Initialization.h
+// expands. Glockenspiel generates the complete header, this excerpt
+// is written by hand. The keycode lists precede the keypos list to
+// check that ids do not follow the order of the definitions in
+// the header.
+//
+#define GLS_INPUTS___KEYCODE(OP) \
+   OP(Key_B, Key_B)
+
+#define GLS_INPUTS___COMPLEX_KEYCODE(OP) \
+   OP(ctrl_X, ctrl_X, LCTRL(Key_X))
+
+#define GLS_INPUTS___KEYPOS(OP) \
+   OP(LeftThumb, LeftThumb, 1, 7) \
+   OP(RightThumb, RightThumb, 1, 8) \
+   OP(Fn, Fn, 3, 6) \
+   OP(Special, Special, 0, 6)
@@ -0,0 +1,57 @@
+/* -*- mode: c++ -*-
+ * Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+ * Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// The pattern definitions that test_profile_order.py reorders.
+// The sketch is only read by tools/papageno-profile-order.py and
+// is not meant to be built.
+
+/*
+glockenspiel_begin
+
+input: LeftThumb <KEYPOS> = $ 1, 7 $
+input: RightThumb <KEYPOS> = $ 1, 8 $
+input: Fn <KEYPOS> = $ 3, 6 $
+input: Special <KEYPOS> = $ 0, 6 $
+
+input: Key_B <KEYCODE>
+input: ctrl_X <COMPLEX_KEYCODE> = $ LCTRL(Key_X) $
+
+% Left thumb tap dance
+%
+|LeftThumb|*2 : Key_Escape
+
+% Right thumb tap dances
+%
+|RightThumb|*2 : Key_Enter
+% A triple tap
+|RightThumb|*3 : Key_Tab
+
+%|Special|*3 : Key_F2
+
+{Fn, LeftThumb} : Key_F1
+
+|Key_B|*2 : Key_F10
+
+phrase: twoCtrlX = |ctrl_X|*2
+
+|Special|*2 : Key_F3
+
+#twoCtrlX: Key_F11
+
+glockenspiel_end
+*/
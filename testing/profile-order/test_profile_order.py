@@ -0,0 +1,211 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Tests of tools/papageno-profile-order.py on the fixture sketch.ino.
+#
+# profile.txt lists hit counts by input name, stats.txt holds the same
+# counts as output of papageno.stats that is mapped to inputs via
+# Kaleidoscope-Papageno-Sketch.hpp.
+#
+# Usage: test_profile_order.py
+
+import importlib.util
+import os
+import subprocess
+import sys
+import unittest
+
+here = os.path.dirname(os.path.abspath(__file__))
+tool = os.path.join(here, "..", "..", "tools", "papageno-profile-order.py")
+
+def fixture(name):
+   return os.path.join(here, name)
+
+def loadTool():
+
+   spec = importlib.util.spec_from_file_location("papageno_profile_order", tool)
+   module = importlib.util.module_from_spec(spec)
+   spec.loader.exec_module(module)
+
+   return module
+
+def runTool(*args):
+
+   process = subprocess.run(
+      [sys.executable, tool] + [fixture(a) for a in args],
+      stdout = subprocess.PIPE, stderr = subprocess.PIPE,
+      universal_newlines = True)
+
+   return process
+
+# The patterns of the fixture in the order that the profile demands.
+# The right thumb paragraph (50) and Key_B (30) precede the group of
+# the paragraphs that share LeftThumb (10 + 5 for Fn). The group
+# keeps its order. The phrase definition separates the last two
+# paragraphs that swap on their own.
+#
+expected_patterns = [
+   "|RightThumb|*2 : Key_Enter",
+   "|RightThumb|*3 : Key_Tab",
+   "|Key_B|*2 : Key_F10",
+   "|LeftThumb|*2 : Key_Escape",
+   "{Fn, LeftThumb} : Key_F1",
+   "#twoCtrlX: Key_F11",
+   "|Special|*2 : Key_F3"
+]
+
+class ProfileOrderTest(unittest.TestCase):
+
+   def setUp(self):
+
+      with open(fixture("sketch.ino")) as f:
+         self.sketch = f.read().splitlines()
+
+   def reordered(self, profile, header = None):
+
+      process = runTool("sketch.ino", profile, *([header] if header else []))
+
+      self.assertEqual(process.returncode, 0, process.stderr)
+
+      return process.stdout.splitlines(), process.stderr
+
+   def patterns(self, lines):
+      return [l for l in lines if l[:1] in ("|", "{", "#")]
+
+   def testParagraphs(self):
+
+      lines, _ = self.reordered("profile.txt")
+
+      self.assertEqual(self.patterns(lines), expected_patterns)
+
+      # Nothing is lost or duplicated
+      #
+      self.assertEqual(sorted(lines), sorted(self.sketch))
+
+      # Comments move with their paragraph
+      #
+      i = lines.index("|RightThumb|*2 : Key_Enter")
+      self.assertEqual(lines[i - 2:i], ["% Right thumb tap dances", "%"])
+      self.assertEqual(lines[i + 1:i + 3],
+                       ["% A triple tap", "|RightThumb|*3 : Key_Tab"])
+
+   def testFixedParagraphs(self):
+
+      lines, _ = self.reordered("profile.txt")
+
+      # Paragraphs without patterns, e.g. commented out patterns, the
+      # phrase definition and the inputs, keep their places among the
+      # paragraphs, and so does everything outside the Glockenspiel clause
+      #
+      def paragraphs(lines):
+         result = [[]]
+         for line in lines:
+            if line.strip():
+               result[-1].append(line)
+            elif result[-1]:
+               result.append([])
+         return result
+
+      before, after = paragraphs(self.sketch), paragraphs(lines)
+
+      self.assertEqual(len(after), len(before))
+
+      for old, new in zip(before, after):
+         if not self.patterns(old):
+            self.assertEqual(new, old)
+
+      begin = self.sketch.index("glockenspiel_begin")
+      self.assertEqual(lines[:begin], self.sketch[:begin])
+
+      end = self.sketch.index("glockenspiel_end")
+      self.assertEqual(lines[end:], self.sketch[end:])
+
+   def testGroups(self):
+
+      lines, _ = self.reordered("profile.txt")
+
+      # Paragraphs that share the input LeftThumb keep their order
+      # although the right thumb paragraph between them moves
+      #
+      self.assertLess(lines.index("|LeftThumb|*2 : Key_Escape"),
+                      lines.index("{Fn, LeftThumb} : Key_F1"))
+
+      tool = loadTool()
+      block = self.sketch[self.sketch.index("glockenspiel_begin") + 1:
+                          self.sketch.index("glockenspiel_end")]
+      units = tool.parseBlock([l + "\n" for l in block])
+      representatives = tool.groups(units)
+
+      tokens = [u[2] for u in units]
+      self.assertEqual(tokens, [["|LeftThumb|"],
+                                ["|RightThumb|", "|RightThumb|"],
+                                ["{Fn, LeftThumb}"],
+                                ["|Key_B|"],
+                                [],
+                                ["|Special|"],
+                                ["|ctrl_X|"]])
+      self.assertEqual(representatives[0], representatives[2])
+      self.assertEqual(len(set(representatives[i] for i in (0, 1, 3, 5, 6))), 5)
+
+      # Only the phrase definition is not movable
+      #
+      self.assertEqual([u[3] for u in units],
+                       [True, True, True, True, False, True, True])
+
+   def testHeaderMapping(self):
+
+      tool = loadTool()
+
+      # Keypos inputs first, then keycode and complex keycode inputs,
+      # regardless of the order of the lists in the header
+      #
+      self.assertEqual(tool.readInputs(fixture("Kaleidoscope-Papageno-Sketch.hpp")),
+                       ["LeftThumb", "RightThumb", "Fn", "Special",
+                        "Key_B", "ctrl_X"])
+
+      by_name, _ = self.reordered("profile.txt")
+      by_id, _ = self.reordered("stats.txt", "Kaleidoscope-Papageno-Sketch.hpp")
+
+      self.assertEqual(by_id, by_name)
+
+   def testStatsRequireHeader(self):
+
+      process = runTool("sketch.ino", "stats.txt")
+
+      self.assertNotEqual(process.returncode, 0)
+      self.assertIn("Kaleidoscope-Papageno-Sketch.hpp", process.stderr)
+
+   def testComparisons(self):
+
+      _, report = self.reordered("profile.txt")
+
+      # Root order before: LeftThumb, RightThumb, {Fn, LeftThumb}, Key_B,
+      # Special, ctrl_X. After: RightThumb, Key_B, LeftThumb,
+      # {Fn, LeftThumb}, ctrl_X, Special.
+      #
+      rows = dict((l.split()[0], l.split()[1:]) for l in report.splitlines()
+                     if not l.startswith("#"))
+
+      self.assertEqual(rows["observed"][:2],
+                       [str(195), str(10*1 + 50*2 + 5*3 + 30*4 + 40*5 + 60*6)])
+      self.assertEqual(rows["expected"][:2],
+                       [str(195), str(50*1 + 30*2 + 10*3 + 5*4 + 60*5 + 40*6)])
+
+if __name__ == "__main__":
+   unittest.main()
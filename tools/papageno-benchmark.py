@@ -0,0 +1,231 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Runs the benchmark firmware that is built from testing/benchmark
+# under simavr and prints the CPU cycles per event and the stack
+# high-water mark.
+#
+# Attention: The benchmark has not yet been run under simavr.
+# Its results are unverified and no baseline is shipped with
+# the module.
+#
+# Usage: papageno-benchmark.py firmware.elf [baseline]
+#
+# The output can be stored as a baseline. If a baseline is given,
+# the mean cycles of every category and the stack usage are compared
+# against it. The exit code is 1 if any of them increased by more than
+# PAPAGENO_BENCHMARK_TOLERANCE percent (default: 5).
+#
+# The exit code is 2 if the benchmark did not complete, if its results
+# are implausible or if the baseline is missing or implausible.
+# Every category of the benchmark sketch must have been counted at
+# least once with min <= mean <= max, and the stack high-water mark
+# must be non-zero. A benchmark that silently loses a category
+# would otherwise pass the comparison.
+#
+# The simavr executable can be set via the environment variable SIMAVR.
+
+import os
+import re
+import subprocess
+import sys
+
+record_re = re.compile(r"papageno\.benchmark (\w+)((?: \d+)*)")
+
+# Must match categoryNames in testing/benchmark/benchmark.ino
+#
+categories = ["passthrough", "consumed", "flushed", "matched"]
+
+def run(elf):
+
+   simavr = os.environ.get("SIMAVR", "simavr")
+
+   process = subprocess.run(
+      [simavr, "-m", "atmega32u4", "-f", "16000000", elf],
+      stdout = subprocess.PIPE, stderr = subprocess.STDOUT,
+      universal_newlines = True, timeout = 600)
+
+   return process.stdout.splitlines()
+
+def parse(lines):
+
+   results = {}
+   complete = False
+
+   for line in lines:
+
+      match = record_re.search(line)
+
+      if not match:
+         continue
+
+      name = match.group(1)
+
+      if name == "end":
+         complete = True
+         continue
+
+      results[name] = [int(v) for v in match.group(2).split()]
+
+   return results, complete
+
+def report(results):
+
+   print("%-12s %6s %8s %8s %8s" % ("# category", "count", "min", "mean", "max"))
+
+   for name, values in results.items():
+      if name == "stack":
+         continue
+      print("%-12s %6d %8d %8d %8d" % tuple([name] + values))
+
+   if "stack" in results:
+      print("%-12s %6d" % ("stack", results["stack"][0]))
+
+# Accepts both the output of this script and the raw
+# papageno.benchmark lines of the firmware. Lines that are neither
+# are ignored and show up as missing entries.
+#
+def readBaseline(filename):
+
+   with open(filename) as f:
+      lines = f.read().splitlines()
+
+   baseline, _ = parse(lines)
+
+   if baseline:
+      return baseline
+
+   for line in lines:
+      fields = line.split()
+      if not fields or fields[0].startswith("#"):
+         continue
+      if all(v.isdigit() for v in fields[1:]):
+         baseline[fields[0]] = [int(v) for v in fields[1:]]
+
+   return baseline
+
+# Returns a list of problems, empty if the results are plausible
+#
+def check(results):
+
+   problems = []
+
+   for name in categories:
+
+      if name not in results:
+         problems.append("%s: missing" % name)
+         continue
+
+      values = results[name]
+
+      if len(values) != 4:
+         problems.append("%s: expected 4 values, got %d" % (name, len(values)))
+         continue
+
+      count, min_, mean, max_ = values
+
+      if count == 0:
+         problems.append("%s: no events counted" % name)
+      elif mean == 0:
+         problems.append("%s: zero cycles per event" % name)
+      elif not (min_ <= mean <= max_):
+         problems.append("%s: min %d, mean %d, max %d out of order"
+                           % (name, min_, mean, max_))
+
+   if ("stack" not in results) or (len(results["stack"]) != 1):
+      problems.append("stack: missing")
+   elif results["stack"][0] == 0:
+      problems.append("stack: zero high-water mark")
+
+   return problems
+
+def compare(results, baseline, tolerance):
+
+   regressions = 0
+
+   for name, values in results.items():
+
+      if name not in baseline:
+         continue
+
+      # Mean cycles per event or stack bytes
+      #
+      index = 0 if name == "stack" else 2
+      old, new = baseline[name][index], values[index]
+
+      change = 100.0*(new - old)/old
+
+      sys.stderr.write("%-12s %8d -> %8d (%+.1f%%)\n" % (name, old, new, change))
+
+      if change > tolerance:
+         regressions += 1
+
+   return regressions
+
+def main():
+
+   if len(sys.argv) < 2:
+      sys.stderr.write("Usage: papageno-benchmark.py firmware.elf [baseline]\n")
+      sys.exit(2)
+
+   # Refuse to gate before running the benchmark
+   #
+   baseline = None
+
+   if len(sys.argv) > 2:
+
+      if not os.path.isfile(sys.argv[2]):
+         sys.stderr.write("Baseline %s does not exist\n" % sys.argv[2])
+         sys.exit(2)
+
+      baseline = readBaseline(sys.argv[2])
+      problems = check(baseline)
+
+      if problems:
+         sys.stderr.write("Baseline %s is not a complete benchmark result:\n"
+                           % sys.argv[2])
+         for problem in problems:
+            sys.stderr.write("   %s\n" % problem)
+         sys.exit(2)
+
+   results, complete = parse(run(sys.argv[1]))
+
+   if not complete:
+      sys.stderr.write("The benchmark did not complete\n")
+      sys.exit(2)
+
+   report(results)
+
+   problems = check(results)
+
+   if problems:
+      sys.stderr.write("Implausible benchmark results:\n")
+      for problem in problems:
+         sys.stderr.write("   %s\n" % problem)
+      sys.exit(2)
+
+   if baseline is not None:
+
+      tolerance = float(os.environ.get("PAPAGENO_BENCHMARK_TOLERANCE", "5"))
+
+      if compare(results, baseline, tolerance) > 0:
+         sys.exit(1)
+
+if __name__ == "__main__":
+   main()
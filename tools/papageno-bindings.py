@@ -0,0 +1,114 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Converts a textual description of input and action bindings to
+# the binary format that is described in src/Kaleidoscope/Papageno-Storage.h
+# and prints the Focus command that uploads it.
+#
+# Every line of the description contains one binding, e.g.
+#
+#    input 3 = 2, 7              % move input id 3 to row 2, col 7
+#    keycode 0x0028 = 0x002B     % emit raw keycode 0x2B instead of 0x28
+#    keycode 0x0028 = @ 3, 8     % emit the key at row 3, col 8 instead
+#    keypos 2, 7 = 0x002B        % emit a raw keycode instead of a keypos
+#
+# Everything following a '%' is a comment.
+
+import sys
+
+storage_version = 1
+
+binding_keycode = 1
+binding_keypos = 2
+
+def parseTarget(text):
+
+   text = text.strip()
+
+   if text.startswith("@"):
+      row, col = [int(v, 0) for v in text[1:].split(",")]
+      return binding_keypos, (row << 8) | col
+
+   return binding_keycode, int(text, 0)
+
+def parse(lines):
+
+   inputs = []
+   actions = []
+
+   for line_number, line in enumerate(lines, 1):
+
+      line = line.split("%")[0].strip()
+
+      if not line:
+         continue
+
+      kind, _, rest = line.partition(" ")
+      source, _, target = rest.partition("=")
+
+      if kind == "input":
+         row, col = [int(v, 0) for v in target.split(",")]
+         inputs.append((int(source, 0), row, col))
+      elif kind == "keycode":
+         to_kind, to_raw = parseTarget(target)
+         actions.append((binding_keycode, int(source, 0), to_kind, to_raw))
+      elif kind == "keypos":
+         row, col = [int(v, 0) for v in source.split(",")]
+         to_kind, to_raw = parseTarget(target)
+         actions.append((binding_keypos, (row << 8) | col, to_kind, to_raw))
+      else:
+         raise SyntaxError("Line %d: unknown binding \"%s\"" % (line_number, kind))
+
+   return inputs, actions
+
+def serialize(inputs, actions):
+
+   records = []
+
+   for input_id, row, col in inputs:
+      records += [input_id, row, col]
+
+   for from_kind, from_raw, to_kind, to_raw in actions:
+      records += [(from_kind << 4) | to_kind,
+                  from_raw & 0xFF, from_raw >> 8,
+                  to_raw & 0xFF, to_raw >> 8]
+
+   checksum = 0
+   for byte in records:
+      checksum ^= byte
+
+   header = [ord('P'), ord('G'), storage_version,
+             len(inputs), len(actions), checksum]
+
+   return header + records
+
+def main():
+
+   if len(sys.argv) > 1:
+      with open(sys.argv[1]) as f:
+         lines = f.readlines()
+   else:
+      lines = sys.stdin.readlines()
+
+   blob = serialize(*parse(lines))
+
+   print("papageno.bindings " + " ".join(str(b) for b in blob))
+
+if __name__ == "__main__":
+   main()
@@ -0,0 +1,90 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Renders the binary log records that are printed by the Focus
+# command "papageno.log" (see src/Kaleidoscope/Papageno-Log.h).
+#
+# Usage: papageno-log-decode.py [file]    (reads stdin if no file is given)
+
+import sys
+
+def keypos(value):
+   return "(%d, %d)" % (value >> 8, value & 0xFF)
+
+# Keep in sync with the event ids in src/Kaleidoscope/Papageno-Log.h
+#
+events = {
+   1 : lambda a0, a1, a2: "key %s, keycode 0x%04x, key_state 0x%02x" \
+                              % (keypos(a1), a2, a0),
+   2 : lambda a0, a1, a2: "feed input %d, flags 0x%02x, time %d" \
+                              % (a1, a0, a2),
+   3 : lambda a0, a1, a2: "flush input %d at %s, key_state 0x%02x" \
+                              % (a1, keypos(a2), a0),
+   # Signal ids are the values of Papageno's PPG_Signal_Id enum
+   #
+   4 : lambda a0, a1, a2: "signal %d" % a0,
+   5 : lambda a0, a1, a2: "abort by %s, %d events flushed, keycode 0x%04x" \
+                              % (keypos(a1), a0, a2),
+   6 : lambda a0, a1, a2: "pass through unblocked input %d" % a1,
+   7 : lambda a0, a1, a2: "bad engine state, passing input %d" % a1,
+   8 : lambda a0, a1, a2: "keycode action 0x%04x, key_state 0x%02x" \
+                              % (a1, a0),
+   9 : lambda a0, a1, a2: "keypos action %s, key_state 0x%02x" \
+                              % (keypos(a1), a0),
+   10 : lambda a0, a1, a2: "loop, %d active tokens, %d buffered events" \
+                              % (a1, a2),
+   11 : lambda a0, a1, a2: "macro 0x%04x dropped, %d macros queued" \
+                              % (a1, a0)
+}
+
+def decode(lines):
+
+   for line in lines:
+
+      fields = line.split()
+
+      if len(fields) == 1 and fields[0].isdigit():
+         if int(fields[0]) > 0:
+            print("%s records dropped" % fields[0])
+         continue
+
+      if len(fields) != 5:
+         continue
+
+      event_id, a0, time, a1, a2 = [int(f) for f in fields]
+
+      render = events.get(event_id)
+
+      if render is None:
+         text = "unknown event %d (%d, %d, %d)" % (event_id, a0, a1, a2)
+      else:
+         text = render(a0, a1, a2)
+
+      print("%5d ms: %s" % (time, text))
+
+def main():
+
+   if len(sys.argv) > 1:
+      with open(sys.argv[1]) as f:
+         decode(f.readlines())
+   else:
+      decode(sys.stdin.readlines())
+
+if __name__ == "__main__":
+   main()
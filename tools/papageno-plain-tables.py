@@ -0,0 +1,166 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Writes the input tables of Papageno-Initialization.h as literal C++.
+#
+# Glockenspiel describes the inputs of a sketch by the X-macros
+# GLS_INPUTS___KEYPOS, GLS_INPUTS___KEYCODE and GLS_INPUTS___COMPLEX_KEYCODE
+# in Kaleidoscope-Papageno-Sketch.hpp. By default, Papageno-Initialization.h
+# expands them several times to derive the input ids, the keypos switch,
+# the keycode table, the keypos lookup table and the size of the
+# bitfield of blocked inputs. This script performs the expansion once,
+# on the host. If PPG_KLS_PLAIN_TABLES is defined, Papageno-Initialization.h
+# includes the result instead. The values are the same in both modes.
+#
+# Usage: papageno-plain-tables.py Kaleidoscope-Papageno-Sketch.hpp output
+
+import re
+import sys
+
+define_re = re.compile(r"#\s*define\s+GLS_INPUTS___(\w+)\s*\(\s*OP\s*\)")
+
+def readDefines(text):
+
+   # Joins continued lines
+   #
+   text = re.sub(r"\\\s*\n", " ", text)
+
+   defines = {}
+
+   for line in text.splitlines():
+      match = define_re.search(line)
+      if match:
+         defines[match.group(1)] = line[match.end():].replace("__NL__", " ")
+
+   return defines
+
+def splitArguments(text):
+
+   args = []
+   depth = 0
+   current = ""
+
+   for c in text:
+      if c in "([{":
+         depth += 1
+      elif c in ")]}":
+         depth -= 1
+      if c == "," and depth == 0:
+         args.append(current.strip())
+         current = ""
+      else:
+         current += c
+
+   args.append(current.strip())
+
+   return args
+
+def invocations(body):
+
+   # The arguments of all OP(...) invocations
+   #
+   result = []
+   pos = 0
+
+   while True:
+
+      match = re.compile(r"\bOP\s*\(").search(body, pos)
+      if not match:
+         return result
+
+      depth = 1
+      i = match.end()
+      while depth > 0:
+         if i >= len(body):
+            raise SyntaxError("Unbalanced parentheses in input list")
+         if body[i] == "(":
+            depth += 1
+         elif body[i] == ")":
+            depth -= 1
+         i += 1
+
+      result.append(splitArguments(body[match.end():i - 1]))
+      pos = i
+
+def write(out, keypos, keycode):
+
+   n_keypos = len(keypos)
+   n_inputs = n_keypos + len(keycode)
+
+   out.write("// Generated by papageno-plain-tables.py. Do not edit.\n")
+   out.write("//\n")
+   out.write("// Included by Papageno-Initialization.h if PPG_KLS_PLAIN_TABLES is defined.\n\n")
+
+   out.write("enum PPG_KLS_Input_Ids {\n\n")
+   for input_id, (uid, user_id, row, col) in enumerate(keypos):
+      out.write("   PPG_%s_Keypos_Name = %d, // %s\n" % (uid, input_id, user_id))
+   out.write("\n   PPG_KLS_N_Keypos_Inputs = %d,\n\n" % n_keypos)
+   for input_id, (uid, user_id, key) in enumerate(keycode, n_keypos):
+      out.write("   PPG_%s_Keycode_Name = %d, // %s\n" % (uid, input_id, user_id))
+   out.write("\n   PPG_KLS_N_Inputs_End = %d\n};\n\n" % n_inputs)
+
+   out.write("static constexpr unsigned PPG_KLS_N_Input_Bytes = %d;\n\n"
+                % ((n_inputs + 7)//8))
+
+   out.write("PPG_Input_Id inputIdFromKeyposIndex(PPG_KLS_Keypos_Index index)\n{\n")
+   out.write("   switch(index) {\n")
+   for uid, user_id, row, col in keypos:
+      out.write("      case (%s)*COLS + (%s): return PPG_%s_Keypos_Name;\n"
+                   % (row, col, uid))
+   out.write("   }\n\n   return PPG_KLS_Not_An_Input;\n}\n\n")
+
+   out.write("struct PPG_KLS_Keycode_Inputs {\n\n")
+   out.write("   static constexpr unsigned n = %d;\n\n" % len(keycode))
+   out.write("   static constexpr uint16_t keys[n + 1] PROGMEM = {\n")
+   for uid, user_id, key in keycode:
+      out.write("      keyRaw(%s),\n" % key)
+   out.write("      0\n   };\n};\n\n")
+
+   out.write("PPG_KLS_Keypos ppg_kls_keypos_lookup[] = {\n")
+   for uid, user_id, row, col in keypos:
+      out.write("   { .row = %s, .col = %s },\n" % (row, col))
+   out.write("   { .row = 0xFF, .col = 0xFF }\n};\n")
+
+def main():
+
+   if len(sys.argv) != 3:
+      sys.stderr.write("Usage: papageno-plain-tables.py Kaleidoscope-Papageno-Sketch.hpp output\n")
+      sys.exit(2)
+
+   with open(sys.argv[1]) as f:
+      defines = readDefines(f.read())
+
+   keypos = [tuple(a) for a in invocations(defines.get("KEYPOS", ""))]
+
+   # Simple keycode inputs are named after their key, complex ones
+   # carry the key expression as the remaining arguments
+   #
+   keycode = [(a[0], a[1], a[1]) for a in invocations(defines.get("KEYCODE", ""))] \
+           + [(a[0], a[1], ", ".join(a[2:])) \
+                 for a in invocations(defines.get("COMPLEX_KEYCODE", ""))]
+
+   for a in keypos:
+      if len(a) != 4:
+         raise SyntaxError("Unexpected KEYPOS input %s" % (a,))
+
+   with open(sys.argv[2], "w") as out:
+      write(out, keypos, keycode)
+
+if __name__ == "__main__":
+   main()
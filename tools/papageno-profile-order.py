@@ -0,0 +1,382 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Reorders the pattern definitions of a sketch by how often their first
+# inputs are actually typed.
+#
+# Assumption: Glockenspiel emits the children of a node of the pattern
+# tree in the order the patterns are defined, and an event is compared
+# with the children one after another until one matches. Defining
+# patterns whose first input is typed often first then reduces the
+# number of comparisons. This order has not been confirmed against the
+# pattern tree in a generated Kaleidoscope-Papageno-Sketch.hpp. If
+# Glockenspiel sorts the children itself, reordering has no effect
+# on matching, but it is harmless.
+#
+# Only the children of the root, i.e. the first tokens of the patterns,
+# are reordered. Deeper levels of the tree keep the order in which
+# their patterns are defined. Reordering them would require sorting
+# patterns within a group, and that may change which pattern a
+# shared prefix resolves to.
+#
+# Usage: papageno-profile-order.py sketch.ino profile [header]
+#
+# The reordered sketch is printed to stdout, a report of the number
+# of root comparisons to stderr. Both rows replay the events of the
+# profile against the root children. The row "observed" uses the order
+# of the sketch as it is, i.e. the order the profile was recorded
+# with. The row "expected" uses the order after reordering. An event
+# is compared with the children in order up to the first one whose
+# first token contains its input, events of other inputs are compared
+# with all children.
+#
+# The profile is either the output of the Focus command papageno.stats
+# (see src/Kaleidoscope/Papageno-Telemetry.h) or a list of hit counts
+# per input,
+#
+#    LeftThumb3 1203
+#    RightThumb2 877
+#
+# Everything following a '%' is a comment.
+#
+# Telemetry reports counts per input id. To map ids to inputs, the
+# output of papageno.stats requires the header Kaleidoscope-Papageno-Sketch.hpp
+# that Glockenspiel generates next to the sketch. Ids are assigned in 
+# the order of its input lists, KEYPOS inputs first, then KEYCODE and
+# COMPLEX_KEYCODE inputs.
+#
+# Patterns are moved as paragraphs, i.e. runs of lines that are not
+# separated by blank lines, together with the comments they contain. 
+# A paragraph with several patterns is never split. Paragraphs without 
+# patterns, e.g. commented out patterns, and blank lines stay where 
+# they are. The paragraphs with patterns swap their places.
+#
+# Paragraphs whose first tokens share an input, directly or via other
+# paragraphs, form a group and keep their relative order, so the 
+# tree and its behavior remain the same. Paragraphs that contain 
+# other statements, e.g. phrase definitions, are not moved. Paragraphs
+# are only reordered between them.
+
+import importlib.util
+import os
+import re
+import sys
+
+phrase_re = re.compile(r"^\s*phrase:\s*(\w+)\s*=\s*(.*)$")
+statement_re = re.compile(r"^\s*\w+:")
+first_token_re = re.compile(r'\s*(\|[^|]*\||\{[^}]*\}|\[[^\]]*\]|"[^"]*"|#\w+)')
+name_re = re.compile(r"\w+")
+
+def isPatternStart(line):
+   return line.lstrip()[:1] in ("|", "{", "[", "\"", "#")
+
+def isComment(line):
+   return line.lstrip().startswith("%")
+
+def findBlock(lines):
+
+   begin = end = None
+
+   for i, line in enumerate(lines):
+      if line.strip() == "glockenspiel_begin":
+         begin = i + 1
+      elif line.strip() == "glockenspiel_end":
+         end = i
+
+   if begin is None or end is None:
+      raise SyntaxError("No glockenspiel_begin ... glockenspiel_end clause found")
+
+   return begin, end
+
+def paragraphs(lines):
+
+   # (first line, last line + 1) of the runs of non-blank lines
+   #
+   result = []
+   first = None
+
+   for i, line in enumerate(lines + ["\n"]):
+      if line.strip():
+         if first is None:
+            first = i
+      elif first is not None:
+         result.append((first, i))
+         first = None
+
+   return result
+
+def parseBlock(lines):
+
+   phrases = {}
+   units = []        # (first line, last line + 1, first tokens, movable)
+
+   for first, last in paragraphs(lines):
+
+      tokens = []
+      movable = True
+      defines_phrase = False
+
+      i = first
+      while i < last:
+
+         line = lines[i]
+
+         match = phrase_re.match(line)
+         if match:
+            phrases[match.group(1)] = match.group(2)
+            defines_phrase = True
+
+         if isComment(line):
+            i += 1
+            continue
+
+         if not isPatternStart(line):
+            if statement_re.match(line):
+               movable = False
+            i += 1
+            continue
+
+         # A pattern continues until a comment or the next 
+         # pattern or statement
+         #
+         start = i
+         i += 1
+         while i < last \
+               and not isComment(lines[i]) \
+               and not isPatternStart(lines[i]) \
+               and not statement_re.match(lines[i]):
+            i += 1
+
+         tokens.append(firstToken(lines[start:i], phrases))
+
+      # Patterns must not move across phrase definitions
+      #
+      if tokens or defines_phrase:
+         units.append((first, last, tokens, movable))
+
+   return units
+
+def firstToken(lines, phrases):
+
+   text = "".join(l for l in lines if not isComment(l))
+
+   match = first_token_re.match(text)
+   if not match:
+      return ""
+
+   token = match.group(1)
+
+   # Phrases are resolved to their first token
+   #
+   if token.startswith("#") and token[1:] in phrases:
+      return firstToken([phrases[token[1:]]], phrases)
+
+   return token
+
+def loadPlainTables():
+
+   # The input lists are parsed the same way as by papageno-plain-tables.py
+   #
+   path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                       "papageno-plain-tables.py")
+
+   spec = importlib.util.spec_from_file_location("papageno_plain_tables", path)
+   module = importlib.util.module_from_spec(spec)
+   spec.loader.exec_module(module)
+
+   return module
+
+def readInputs(filename):
+
+   # The names of the inputs in the order of their ids
+   #
+   tables = loadPlainTables()
+
+   with open(filename) as f:
+      defines = tables.readDefines(f.read())
+
+   return [args[1] for kind in ("KEYPOS", "KEYCODE", "COMPLEX_KEYCODE") \
+                   for args in tables.invocations(defines.get(kind, ""))]
+
+def readProfile(lines, inputs):
+
+   counts = {}
+
+   numeric = [l.split() for l in lines if l.split() \
+                 and all(f.isdigit() for f in l.split())]
+
+   if numeric:
+
+      # papageno.stats output, the second line holds one pair
+      # "consumed flushed" per input id
+      #
+      if len(numeric) < 2:
+         raise SyntaxError("Expected the output of papageno.stats")
+
+      if inputs is None:
+         raise SyntaxError("The output of papageno.stats requires "
+                           "Kaleidoscope-Papageno-Sketch.hpp")
+
+      values = [int(v) for v in numeric[1]]
+
+      for input_id, name in enumerate(inputs):
+         if 2*input_id + 1 < len(values):
+            counts[name] = values[2*input_id] + values[2*input_id + 1]
+
+      return counts
+
+   for line in lines:
+
+      fields = line.split("%")[0].split()
+
+      if len(fields) == 2:
+         counts[fields[0]] = counts.get(fields[0], 0) + int(fields[1])
+
+   return counts
+
+def groups(units):
+
+   # Union-find over the input names of the first tokens. Returns 
+   # the representative name for every unit.
+   #
+   parent = {}
+
+   def find(name):
+      while parent.setdefault(name, name) != name:
+         name = parent[name]
+      return name
+
+   for _, _, tokens, _ in units:
+      names = [n for t in tokens for n in name_re.findall(t)] or [""]
+      for name in names[1:]:
+         parent[find(name)] = find(names[0])
+
+   return [find(([n for t in tokens for n in name_re.findall(t)] or [""])[0]) \
+              for _, _, tokens, _ in units]
+
+def reorder(units, counts):
+
+   # Returns the units in their new order. Units that are not movable
+   # separate the ranges that are reordered.
+   #
+   representatives = groups(units)
+
+   # The events of a group are the counts of its distinct inputs
+   #
+   names = {}
+   for (_, _, tokens, _), r in zip(units, representatives):
+      names.setdefault(r, set()).update(n for t in tokens for n in name_re.findall(t))
+
+   weight = dict((r, sum(counts.get(n, 0) for n in group)) \
+                    for r, group in names.items())
+
+   result = []
+   segment = []
+
+   for unit, r in list(zip(units, representatives)) + [(None, None)]:
+
+      if unit is None or not unit[3]:
+
+         # Stable, i.e. ties and units of the same group keep their order
+         #
+         result.extend(u for u, _ in sorted(segment, key = lambda e: -weight[e[1]]))
+         segment = []
+
+         if unit is not None:
+            result.append(unit)
+      else:
+         segment.append((unit, r))
+
+   return result
+
+def rootOrder(units):
+
+   # The distinct first tokens in order of first appearance
+   #
+   result = []
+   for _, _, tokens, _ in units:
+      for token in tokens:
+         if token not in result:
+            result.append(token)
+   return result
+
+def comparisons(order, counts):
+
+   # The number of events in the profile and the number of root 
+   # children they are compared with, see the header
+   #
+   names = [name_re.findall(token) for token in order]
+
+   events = total = 0
+
+   for name, count in counts.items():
+
+      position = next((i + 1 for i, n in enumerate(names) if name in n), 
+                      len(order))
+
+      events += count
+      total += position*count
+
+   return events, total
+
+def main():
+
+   if len(sys.argv) not in (3, 4):
+      sys.stderr.write("Usage: papageno-profile-order.py sketch.ino profile [header]\n")
+      sys.exit(2)
+
+   with open(sys.argv[1]) as f:
+      lines = f.readlines()
+
+   begin, end = findBlock(lines)
+   block = lines[begin:end]
+
+   units = parseBlock(block)
+
+   inputs = readInputs(sys.argv[3]) if len(sys.argv) == 4 else None
+
+   with open(sys.argv[2]) as f:
+      counts = readProfile(f.readlines(), inputs)
+
+   reordered = reorder(units, counts)
+
+   # The reordered units take the places of the original ones, 
+   # all other lines stay where they are
+   #
+   output = []
+   i = 0
+   for (first, last, _, _), unit in zip(units, reordered):
+      output.extend(block[i:first])
+      output.extend(block[unit[0]:unit[1]])
+      i = last
+   output.extend(block[i:])
+
+   sys.stdout.write("".join(lines[:begin] + output + lines[end:]))
+
+   sys.stderr.write("%-10s %10s %12s %10s\n" 
+                       % ("# order", "events", "comparisons", "per event"))
+   for name, order in (("observed", rootOrder(units)), 
+                       ("expected", rootOrder(reordered))):
+      events, total = comparisons(order, counts)
+      sys.stderr.write("%-10s %10d %12d %10.2f\n" 
+                          % (name, events, total, 
+                             total/float(events) if events else 0.0))
+
+if __name__ == "__main__":
+   main()
@@ -0,0 +1,230 @@
+#!/usr/bin/python3
+
+# -*- mode: python -*-
+# Kaleidoscope-Papageno -- Papageno features for Kaleidoscope
+# Copyright (C) 2017 noseglasses <shinynoseglasses@gmail.com>
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Compiles a set of leader sequences to the Aho-Corasick automaton
+# that is described in src/Kaleidoscope/Papageno-Sequences.h and prints
+# the PROGMEM tables as C++ code to be included by the sketch.
+#
+# Usage: papageno-sequences.py [file]    (reads stdin if no file is given)
+#
+# Example description:
+#
+#    name: my_sequences     % name of the automaton variable
+#    timeout: 1000          % ms (default: 1000)
+#
+#    % A sequence of keys, followed by an action callback and its user data
+#    %
+#    Key_G Key_H : kaleidoscope::papageno::Papageno::processMacro, my_macro
+#
+#    % A quoted string is a shorthand for keys Key_A ... Key_Z, Key_0 ... Key_9
+#    %
+#    "abc" : kaleidoscope::papageno::Papageno::processKeycode, (void*)Key_Escape.raw
+#
+# Keys are compared by their name, i.e. the same key must always
+# be spelled the same way.
+#
+# Everything following a '%' is a comment.
+
+import sys
+from collections import deque
+
+def expandKeys(text):
+
+   keys = []
+
+   for token in text.split():
+
+      if token.startswith('"') and token.endswith('"') and len(token) > 2:
+         for c in token[1:-1]:
+            if not c.isalnum():
+               raise SyntaxError("Unsupported character '%s' in %s" % (c, token))
+            keys.append("Key_" + c.upper())
+      else:
+         keys.append(token)
+
+   return keys
+
+def parse(lines):
+
+   name = None
+   timeout = 1000
+   sequences = []
+
+   for line_number, line in enumerate(lines, 1):
+
+      line = line.split("%")[0].strip()
+
+      if not line:
+         continue
+
+      if line.startswith("name:"):
+         name = line[len("name:"):].strip()
+         continue
+
+      if line.startswith("timeout:"):
+         timeout = int(line[len("timeout:"):].strip(), 0)
+         continue
+
+      keys, sep, action = line.partition(":")
+
+      keys = expandKeys(keys)
+      func, _, user_data = action.partition(",")
+
+      if not sep or not keys or not func.strip():
+         raise SyntaxError("Line %d: expected \"keys : callback, user_data\"" \
+                              % line_number)
+
+      sequences.append((keys, func.strip(), user_data.strip() or "NULL"))
+
+   if name is None:
+      raise SyntaxError("No automaton name defined")
+
+   return name, timeout, sequences
+
+class State(object):
+
+   def __init__(self):
+      self.edges = []        # (symbol, target) in order of definition
+      self.failure = 0
+      self.output = 0        # 1 + action index, 0 if none
+
+   def target(self, symbol):
+      for s, t in self.edges:
+         if s == symbol:
+            return t
+      return None
+
+def build(sequences):
+
+   states = [State()]
+
+   # The goto function (a trie)
+   #
+   for index, (keys, _, _) in enumerate(sequences):
+
+      state = 0
+
+      for key in keys:
+         target = states[state].target(key)
+         if target is None:
+            target = len(states)
+            states.append(State())
+            states[state].edges.append((key, target))
+         state = target
+
+      if states[state].output != 0:
+         raise SyntaxError("Sequence %s defined twice" % " ".join(keys))
+
+      states[state].output = index + 1
+
+   # Failure links in breadth first order. A state without an output
+   # of its own inherits the output of its failure state, i.e. the
+   # longest sequence that is a suffix of the keys entered so far.
+   #
+   queue = deque(t for _, t in states[0].edges)
+
+   while queue:
+
+      state = queue.popleft()
+
+      for symbol, target in states[state].edges:
+
+         queue.append(target)
+
+         failure = states[state].failure
+
+         while failure != 0 and states[failure].target(symbol) is None:
+            failure = states[failure].failure
+
+         failure_target = states[failure].target(symbol)
+         states[target].failure = failure_target if failure_target else 0
+
+         if states[target].output == 0:
+            states[target].output = states[states[target].failure].output
+
+   return states
+
+def generate(name, timeout, sequences, states):
+
+   ns = "kaleidoscope::papageno::"
+
+   lines = []
+
+   lines.append("// Generated by tools/papageno-sequences.py, do not edit")
+   lines.append("")
+
+   lines.append("static const %sPPG_KLS_Sequence_Edge %s_edges[] PROGMEM = {" \
+                   % (ns, name))
+   first_edges = []
+   n_edges = 0
+   for state in states:
+      first_edges.append(n_edges)
+      for symbol, target in state.edges:
+         lines.append("   { %s, %d }," % (symbol, target))
+         n_edges += 1
+   lines.append("};")
+   lines.append("")
+
+   lines.append("static const %sPPG_KLS_Sequence_State %s_states[] PROGMEM = {" \
+                   % (ns, name))
+   for state, first_edge in zip(states, first_edges):
+      lines.append("   { %d, %d, %d, %d }," \
+         % (state.failure, first_edge, len(state.edges), state.output))
+   lines.append("};")
+   lines.append("")
+
+   lines.append("static const %sPPG_KLS_Sequence_Action %s_actions[] PROGMEM = {" \
+                   % (ns, name))
+   for keys, func, user_data in sequences:
+      lines.append("   { (PPG_Action_Callback_Fun)%s, (void*)(uintptr_t)(%s) }, // %s" \
+                      % (func, user_data, " ".join(keys)))
+   lines.append("};")
+   lines.append("")
+
+   lines.append("static const %sPPG_KLS_Sequence_Automaton %s PROGMEM = {" \
+                   % (ns, name))
+   lines.append("   %s_states, %s_edges, %s_actions, %d" \
+                   % (name, name, name, timeout))
+   lines.append("};")
+
+   return "\n".join(lines)
+
+def main():
+
+   if len(sys.argv) > 1:
+      with open(sys.argv[1]) as f:
+         lines = f.readlines()
+   else:
+      lines = sys.stdin.readlines()
+
+   name, timeout, sequences = parse(lines)
+   states = build(sequences)
+
+   print(generate(name, timeout, sequences, states))
+
+   n_edges = sum(len(s.edges) for s in states)
+
+   # Sizes as on the atmega32u4
+   #
+   sys.stderr.write("%d sequences, %d states, %d edges, %d bytes PROGMEM\n" \
+      % (len(sequences), len(states), n_edges,
+         7*len(states) + 4*n_edges + 4*len(sequences) + 8))
+
+if __name__ == "__main__":
+   main()